@@ -0,0 +1,606 @@
+// Times the stages of the program on synthetic datasets and checks
+// the normals against the ones the datasets were rendered from.
+//
+// A dataset is a known normal-field rendered as a Lambertian surface
+// under a ring of lamps like the scanner's, written as files like a
+// real one. Then, for every resolution and thread-count, decoding,
+// conversion to gray, solving, encoding and integrating the heights
+// are timed on their own. So is solving the decoded images as frames
+// in memory, see FrameSolver, which has to give the same normals.
+// Last, the whole pipeline runs once per resolution and its
+// allocations are counted, so a copy of a whole image that creeps
+// back in fails the benchmark like inaccurate normals do.
+
+#include "../src/io.hpp"
+#include "../src/solve.hpp"
+#include "../src/util.hpp"
+#include "../src/pipeline.hpp"
+#include "../src/frames.hpp"
+#include "../src/integrate.hpp"
+#include "../src/ReflectionMap.hpp"
+#include "../src/LightStack.hpp"
+#include "../src/NormalMap.hpp"
+#include "../src/Vec.hpp"
+using std::vector;
+using std::string;
+using std::size_t;
+using std::uint8_t;
+using std::uint16_t;
+
+#include <iostream>
+using std::cout;
+using std::cerr;
+
+#include <iomanip>
+using std::setw;
+using std::setprecision;
+using std::fixed;
+
+#include <stdexcept>
+using std::invalid_argument;
+
+#include <chrono>
+using std::chrono::steady_clock;
+using std::chrono::duration;
+
+#include <cmath>
+using std::sin;
+using std::cos;
+using std::acos;
+using std::sqrt;
+
+#include <algorithm>
+using std::min;
+using std::max;
+
+#include <filesystem>
+using std::filesystem::path;
+using std::filesystem::create_directories;
+
+#include <functional>
+using std::function;
+
+#include <future>
+using std::future;
+
+#include <limits>
+
+#include <atomic>
+using std::atomic;
+
+#include <sstream>
+using std::ostringstream;
+
+#include <new>
+#include <cstdlib>
+
+#include <cassert>
+
+
+const double PI = 3.14159265358979323846;
+
+// The lamps of the scanner: all around the object, 40 degrees from the top.
+const double LAMP_POLAR_DEGREES = 40.0;
+
+const double ALBEDO = 0.8;
+
+
+// Every allocation of the process goes through these. A copy of an
+// image needs an allocation of its size, so counting the large ones
+// counts the copies.
+atomic<size_t> largeAllocationSize{ std::numeric_limits<size_t>::max() };
+atomic<size_t> largeAllocations{ 0 };
+atomic<size_t> allocatedBytes{ 0 };
+
+
+// All forms of new and delete, aligned or not, single or array, come
+// here, so every buffer is counted and freed the way it was allocated.
+// Not inlined, so the compiler never pairs free with new.
+[[gnu::noinline]] void* allocate(const size_t size, const size_t alignment) {
+	allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+	if (size >= largeAllocationSize.load(std::memory_order_relaxed)) {
+		largeAllocations.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	const size_t n = size == 0 ? 1 : size;
+#if defined(_WIN32)
+	void* p = _aligned_malloc(n, alignment);
+#else
+	void* p = alignment <= alignof(std::max_align_t)
+		? std::malloc(n)
+		: std::aligned_alloc(alignment, (n + alignment - 1) / alignment * alignment);
+#endif
+	if (!p) throw std::bad_alloc{};
+	return p;
+}
+
+
+[[gnu::noinline]] void deallocate(void* p) noexcept {
+#if defined(_WIN32)
+	_aligned_free(p);
+#else
+	std::free(p);
+#endif
+}
+
+
+void* operator new(const size_t size) { return allocate(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__); }
+void* operator new[](const size_t size) { return allocate(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__); }
+void* operator new(const size_t size, const std::align_val_t alignment) { return allocate(size, static_cast<size_t>(alignment)); }
+void* operator new[](const size_t size, const std::align_val_t alignment) { return allocate(size, static_cast<size_t>(alignment)); }
+
+void operator delete(void* p) noexcept { deallocate(p); }
+void operator delete[](void* p) noexcept { deallocate(p); }
+void operator delete(void* p, size_t) noexcept { deallocate(p); }
+void operator delete[](void* p, size_t) noexcept { deallocate(p); }
+void operator delete(void* p, std::align_val_t) noexcept { deallocate(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { deallocate(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { deallocate(p); }
+void operator delete[](void* p, size_t, std::align_val_t) noexcept { deallocate(p); }
+
+
+struct Resolution {
+	size_t width;
+	size_t height;
+};
+
+
+struct Options {
+	string workDirectory;
+	vector<Resolution> resolutions{ { 640, 480 }, { 1920, 1080 }, { 4096, 3072 } };
+	vector<unsigned int> threadCounts;
+	int repeats = 3;
+	int nLamps = 8;
+	Precision precision = Precision::Double;
+	InstructionSet isa = detectInstructionSet();
+	SampleFormat sampleFormat = SampleFormat::UInt16;
+	Rejection rejection;
+	OutputFormat output;
+
+	// Mean angular error in degrees that still counts as correct.
+	double maxMeanError = 1.0;
+};
+
+
+// Bumps of the height-field a * sin(u) * sin(v), in pixels. The
+// slopes stay below 22 degrees, so every pixel is lit by all lamps
+// and nothing is in shadow.
+struct Bumps {
+	double a;
+	double du;
+	double dv;
+
+	Bumps(const size_t width, const size_t height)
+		:
+		du(2 * PI * 4 / width), dv(2 * PI * 3 / height)
+	{
+		a = 0.4 / max(du, dv);
+	}
+};
+
+
+double syntheticHeight(const size_t x, const size_t y, const size_t width, const size_t height) {
+	const Bumps b{ width, height };
+	return b.a * sin(b.du * x) * sin(b.dv * y);
+}
+
+
+Vec3 syntheticNormal(const size_t x, const size_t y, const size_t width, const size_t height) {
+	const Bumps b{ width, height };
+	const double u = b.du * x;
+	const double v = b.dv * y;
+
+	const Vec3 n{ -b.a * b.du * cos(u) * sin(v), -b.a * b.dv * sin(u) * cos(v), 1.0 };
+	return n.normalize();
+}
+
+
+string datasetDirectory(const Options& options, const Resolution& r) {
+	const string name = std::to_string(r.width) + "x" + std::to_string(r.height) + "_" + std::to_string(options.nLamps);
+	return (path{ options.workDirectory } / name).string();
+}
+
+
+// Renders the normal-field under every lamp into "dir/img_azimuthal_polar.png".
+// The lamps are spread evenly around the object, at whole degrees.
+void writeSyntheticDataset(const string& dir, const Resolution& r, const int nLamps) {
+	create_directories(dir);
+
+	vector<unsigned char> rgb(r.width * r.height * 3);
+
+	for (int k = 0; k < nLamps; ++k) {
+		const int azimuthalDegrees = k * 360 / nLamps;
+		const Vec3 l = incidentIlluminationDirection(
+			degreesToRadians(azimuthalDegrees), degreesToRadians(LAMP_POLAR_DEGREES));
+
+		for (size_t y = 0; y < r.height; ++y) {
+			for (size_t x = 0; x < r.width; ++x) {
+				const Vec3 n = syntheticNormal(x, y, r.width, r.height);
+				const double value = max(0.0, ALBEDO * (n[0] * l[0] + n[1] * l[1] + n[2] * l[2]));
+				const unsigned char gray = static_cast<unsigned char>(std::lround(value * 255));
+
+				unsigned char* pixel = &rgb[(y * r.width + x) * 3];
+				pixel[0] = gray;
+				pixel[1] = gray;
+				pixel[2] = gray;
+			}
+		}
+
+		const string file = (path{ dir } /
+			("img_" + std::to_string(azimuthalDegrees) + "_" + std::to_string(static_cast<int>(LAMP_POLAR_DEGREES)) + ".png")).string();
+
+		std::unique_ptr<OIIO::ImageOutput> out = OIIO::ImageOutput::create(file);
+		if (!out) throw invalid_argument{ "Cannot create file: " + file };
+		const OIIO::ImageSpec spec(static_cast<int>(r.width), static_cast<int>(r.height), 3, OIIO::TypeDesc::UINT8);
+		if (!out->open(file, spec) || !out->write_image(OIIO::TypeDesc::UINT8, &rgb[0])) {
+			throw invalid_argument{ "Cannot write file: " + file };
+		}
+		out->close();
+	}
+}
+
+
+// Mean and max angle in degrees between the solved and the true normals.
+std::pair<double, double> angularError(const vector<double>& normals, const Resolution& r) {
+	double sum = 0.0;
+	double maximum = 0.0;
+
+	for (size_t y = 0; y < r.height; ++y) {
+		for (size_t x = 0; x < r.width; ++x) {
+			const Vec3 truth = syntheticNormal(x, y, r.width, r.height);
+			const double* n = &normals[(y * r.width + x) * 3];
+			const double cosine = min(1.0, n[0] * truth[0] + n[1] * truth[1] + n[2] * truth[2]);
+			const double degrees = acos(cosine) * 180.0 / PI;
+
+			sum += degrees;
+			maximum = max(maximum, degrees);
+		}
+	}
+
+	return { sum / (r.width * r.height), maximum };
+}
+
+
+// Root mean square difference in pixels between the integrated and the
+// true heights, both relative to their mean.
+double heightError(const HeightMap& heightMap, const Resolution& r) {
+	double truthMean = 0.0;
+	for (size_t y = 0; y < r.height; ++y) {
+		for (size_t x = 0; x < r.width; ++x) {
+			truthMean += syntheticHeight(x, y, r.width, r.height);
+		}
+	}
+	truthMean /= r.width * r.height;
+
+	double sum = 0.0;
+	for (size_t y = 0; y < r.height; ++y) {
+		for (size_t x = 0; x < r.width; ++x) {
+			const double difference =
+				heightMap.heightData[y * r.width + x] - (syntheticHeight(x, y, r.width, r.height) - truthMean);
+			sum += difference * difference;
+		}
+	}
+	return sqrt(sum / (r.width * r.height));
+}
+
+
+// Best time out of the repeats, in seconds.
+double bestOf(const int repeats, const function<void()>& fn) {
+	double best = std::numeric_limits<double>::max();
+	for (int i = 0; i < repeats; ++i) {
+		const steady_clock::time_point begin = steady_clock::now();
+		fn();
+		const steady_clock::time_point end = steady_clock::now();
+		best = min(best, duration<double>(end - begin).count());
+	}
+	return best;
+}
+
+
+// Runs fn(k) for every lamp on the pool and waits for all of them.
+void forEachLamp(ThreadPool& pool, const size_t nLamps, const function<void(size_t)>& fn) {
+	vector<future<void>> tasks;
+	for (size_t k = 0; k < nLamps; ++k) {
+		tasks.push_back(pool.enqueue([k, &fn] { fn(k); }));
+	}
+	waitAll(tasks);
+}
+
+
+// Returns false if the normals are not accurate enough.
+template<typename Sample>
+bool benchmark(const Options& options, const Resolution& r, const unsigned int nThreads) {
+	const string dir = datasetDirectory(options, r);
+	const vector<string> files = listItems(dir);
+	const size_t nPixels = r.width * r.height;
+
+	ThreadPool pool{ nThreads };
+
+	vector<vector<unsigned char>> rgb(files.size(), vector<unsigned char>(nPixels * 3));
+	const double decode = bestOf(options.repeats, [&] {
+		forEachLamp(pool, files.size(), [&](const size_t k) {
+			const OIIO::ImageInput::unique_ptr in = openImage(files[k]);
+			if (!in->read_image(OIIO::TypeDesc::UINT8, &rgb[k][0])) {
+				throw invalid_argument{ "Cannot read file: " + files[k] };
+			}
+			in->close();
+		});
+	});
+
+	LightStack<Sample> dataset{ r.width, r.height, files.size() };
+	for (const string& file : files) {
+		const auto [azimuthalAngle, polarAngle] = parseLampAngles(file);
+		dataset.lightDirections.push_back(incidentIlluminationDirection(azimuthalAngle, polarAngle));
+	}
+
+	const double gray = bestOf(options.repeats, [&] {
+		forEachLamp(pool, files.size(), [&](const size_t k) {
+			vector<Sample> values(nPixels);
+			rgbToGray(&rgb[k][0], nPixels, &values[0]);
+			for (size_t y = 0; y < r.height; ++y) {
+				dataset.setRow(k, y, &values[y * r.width]);
+			}
+		});
+	});
+
+	const Solver<Sample> solver{
+		dataset.lightDirections, r.width, r.height, 0.0, options.precision, options.isa, options.rejection };
+
+	vector<double> normalsData(nPixels * 3);
+	const double solve = bestOf(options.repeats, [&] {
+		// The calling thread is one of the workers.
+		solver.solve(dataset, &normalsData[0], pool, nThreads - 1);
+	});
+
+	// Gray and solve at once, from the decoded images.
+	RunOptions frameOptions;
+	frameOptions.precision = options.precision;
+	frameOptions.isa = options.isa;
+	frameOptions.rejection = options.rejection;
+	FrameSolver<Sample> frameSolver{
+		r.width, r.height, PixelFormat{ SampleFormat::UInt8, 3 }, dataset.lightDirections, frameOptions, nThreads };
+	vector<Frame> frameList;
+	for (const vector<unsigned char>& image : rgb) {
+		frameList.push_back({ &image[0] });
+	}
+	vector<double> frameNormals(nPixels * 3);
+	const double frames = bestOf(options.repeats, [&] {
+		frameSolver.solve(frameList, &frameNormals[0]);
+	});
+
+	const NormalMapView normalMap{ r.width, r.height, normalsData };
+	const bool floats = options.output.sampleFormat == SampleFormat::Half || options.output.sampleFormat == SampleFormat::Float;
+	const string outFile = dir + (floats || options.output.layout != Layout::Scanlines ? "_normals.exr" : "_normals.png");
+	const double encode = bestOf(options.repeats, [&] {
+		NormalMapWriter writer{ outFile, r.width, r.height, options.output };
+		writer.write(normalMap, 0);
+		writer.close();
+	});
+
+	vector<float> heightData;
+	const double integrate = bestOf(options.repeats, [&] {
+		heightData = integrateNormals(normalMap, pool, nThreads - 1).heightData;
+	});
+
+	const auto [meanError, maxError] = angularError(normalsData, r);
+	const double heightRms = heightError(HeightMap{ r.width, r.height, std::move(heightData) }, r);
+	const bool sameFrames = frameNormals == normalsData;
+	const bool accurate = meanError <= options.maxMeanError && sameFrames;
+
+	cout << setw(11) << (std::to_string(r.width) + "x" + std::to_string(r.height))
+		<< setw(8) << nThreads
+		<< fixed << setprecision(4)
+		<< setw(10) << decode
+		<< setw(10) << gray
+		<< setw(10) << solve
+		<< setw(10) << frames
+		<< setw(10) << encode
+		<< setw(10) << integrate
+		<< setprecision(1)
+		<< setw(10) << nPixels / solve / 1e6
+		<< setprecision(3)
+		<< setw(10) << meanError
+		<< setw(10) << maxError
+		<< setw(12) << heightRms
+		<< (meanError <= options.maxMeanError ? "" : "  TOO INACCURATE")
+		<< (sameFrames ? "" : "  FRAMES DIFFER") << '\n';
+
+	return accurate;
+}
+
+
+// Runs the pipeline like the program with a height-map and counts the
+// allocations of at least the size of the normal-map. The normals and,
+// if it is that large, the dataset need one each, every other one is a
+// copy. Returns false if there are more.
+template<typename Sample>
+bool countCopies(const Options& options, const Resolution& r) {
+	const string dir = datasetDirectory(options, r);
+	const size_t normalBytes = r.width * r.height * 3 * sizeof(double);
+	const size_t datasetBytes = LightStack<Sample>::strideFor(r.width) * r.height * options.nLamps * sizeof(Sample);
+	const size_t expected = 1 + (datasetBytes >= normalBytes ? 1 : 0);
+
+	RunOptions run;
+	run.datasetDirectory = dir;
+	run.outNormalMap = dir + "_run_normals.exr";
+	run.outHeightMap = dir + "_run_heights.exr";
+	run.output = options.output;
+	run.precision = options.precision;
+	run.isa = options.isa;
+	run.sampleFormat = options.sampleFormat;
+	run.rejection = options.rejection;
+
+	// The run talks a lot, the table shouldn't.
+	ostringstream quiet;
+	std::streambuf* const shown = cout.rdbuf(quiet.rdbuf());
+	largeAllocations = 0;
+	allocatedBytes = 0;
+	largeAllocationSize = normalBytes;
+	try {
+		::run(run);
+	}
+	catch (...) {
+		largeAllocationSize = std::numeric_limits<size_t>::max();
+		cout.rdbuf(shown);
+		throw;
+	}
+	largeAllocationSize = std::numeric_limits<size_t>::max();
+	cout.rdbuf(shown);
+
+	const bool copyFree = largeAllocations <= expected;
+
+	cout << setw(11) << (std::to_string(r.width) + "x" + std::to_string(r.height))
+		<< setw(10) << largeAllocations
+		<< setw(10) << expected
+		<< fixed << setprecision(1)
+		<< setw(12) << allocatedBytes / double(r.width * r.height)
+		<< (copyFree ? "" : "  " + std::to_string(largeAllocations - expected) + " COPIES") << '\n';
+
+	return copyFree;
+}
+
+
+template<typename Sample>
+bool benchmarkAll(const Options& options) {
+	cout << options.nLamps << " lamps, kernel: " << toString(std::min(options.isa, detectInstructionSet()))
+		<< (options.precision == Precision::Float ? ", float" : ", double")
+		<< ", best of " << options.repeats << ", times in seconds, errors in degrees and pixels\n";
+	cout << setw(11) << "size" << setw(8) << "threads"
+		<< setw(10) << "decode" << setw(10) << "gray" << setw(10) << "solve" << setw(10) << "frames" << setw(10) << "encode" << setw(10) << "integrate"
+		<< setw(10) << "Mpx/s" << setw(10) << "mean err" << setw(10) << "max err" << setw(12) << "height err" << '\n';
+
+	bool accurate = true;
+	for (const Resolution& r : options.resolutions) {
+		for (const unsigned int nThreads : options.threadCounts) {
+			accurate = benchmark<Sample>(options, r, nThreads) && accurate;
+		}
+	}
+
+	cout << "\nWhole runs with heights, allocations of at least a normal-map and all bytes allocated\n";
+	cout << setw(11) << "size" << setw(10) << "large" << setw(10) << "needed" << setw(12) << "bytes/px" << '\n';
+	for (const Resolution& r : options.resolutions) {
+		accurate = countCopies<Sample>(options, r) && accurate;
+	}
+	return accurate;
+}
+
+
+vector<Resolution> parseResolutions(const string& s) {
+	vector<Resolution> resolutions;
+	for (const string& item : splitBy(s, ',')) {
+		const vector<string> wh = splitBy(item, 'x');
+		if (wh.size() != 2) throw invalid_argument{ "Resolution expected as WIDTHxHEIGHT: " + item };
+		resolutions.push_back({ std::stoul(wh[0]), std::stoul(wh[1]) });
+	}
+	return resolutions;
+}
+
+
+vector<unsigned int> parseThreadCounts(const string& s) {
+	vector<unsigned int> counts;
+	for (const string& item : splitBy(s, ',')) {
+		const unsigned long n = std::stoul(item);
+		if (n == 0) throw invalid_argument{ "Thread-count must be at least 1." };
+		counts.push_back(static_cast<unsigned int>(n));
+	}
+	return counts;
+}
+
+
+// 1, 2, 4, ... up to all threads of the machine.
+vector<unsigned int> defaultThreadCounts() {
+	const unsigned int parallelism = max(1u, std::thread::hardware_concurrency());
+	vector<unsigned int> counts;
+	for (unsigned int n = 1; n < parallelism; n *= 2) {
+		counts.push_back(n);
+	}
+	counts.push_back(parallelism);
+	return counts;
+}
+
+
+int main(int argc, char* argv[]) {
+	if (argc < 2 || argc % 2 != 0) {
+		cerr << "Pass a directory for the synthetic datasets." << '\n';
+		cerr << "Options: --sizes 640x480,1920x1080, --threads 1,2,4, --repeats <n>, --lamps <n>, --max-error <degrees>," << '\n';
+		cerr << "         --precision double|float, --isa scalar|avx2|avx512, --samples u8|u16|f16|f32," << '\n';
+		cerr << "         --shadow <0..1>, --specular <0..1>, --depth u8|u16|f16|f32, --layout scanlines|tiles|mipmap" << '\n';
+		return EXIT_FAILURE;
+	}
+
+	Options options;
+	options.workDirectory = argv[1];
+	options.threadCounts = defaultThreadCounts();
+
+	try {
+		for (int i = 2; i < argc; i += 2) {
+			const string option{ argv[i] };
+			const string value{ argv[i + 1] };
+
+			if (option == "--sizes") {
+				options.resolutions = parseResolutions(value);
+			}
+			else if (option == "--threads") {
+				options.threadCounts = parseThreadCounts(value);
+			}
+			else if (option == "--repeats") {
+				options.repeats = max(1, std::stoi(value));
+			}
+			else if (option == "--lamps") {
+				options.nLamps = std::stoi(value);
+			}
+			else if (option == "--max-error") {
+				options.maxMeanError = std::stod(value);
+			}
+			else if (option == "--precision") {
+				options.precision = parsePrecision(value);
+			}
+			else if (option == "--isa") {
+				options.isa = parseInstructionSet(value);
+			}
+			else if (option == "--shadow") {
+				options.rejection.enabled = true;
+				options.rejection.shadowThreshold = std::stod(value);
+			}
+			else if (option == "--specular") {
+				options.rejection.enabled = true;
+				options.rejection.specularThreshold = std::stod(value);
+			}
+			else if (option == "--samples") {
+				options.sampleFormat = parseSampleFormat(value);
+			}
+			else if (option == "--depth") {
+				options.output.sampleFormat = parseSampleFormat(value);
+			}
+			else if (option == "--layout") {
+				options.output.layout = parseLayout(value);
+			}
+			else {
+				throw invalid_argument{ "Unknown option: " + option };
+			}
+		}
+
+		cout << "Writing synthetic datasets.\n";
+		for (const Resolution& r : options.resolutions) {
+			writeSyntheticDataset(datasetDirectory(options, r), r, options.nLamps);
+		}
+
+		bool accurate;
+		switch (options.sampleFormat) {
+		case SampleFormat::UInt8: accurate = benchmarkAll<uint8_t>(options); break;
+		case SampleFormat::Half: accurate = benchmarkAll<Half>(options); break;
+		case SampleFormat::Float: accurate = benchmarkAll<float>(options); break;
+		default: accurate = benchmarkAll<uint16_t>(options); break;
+		}
+
+		if (!accurate) {
+			return EXIT_FAILURE;
+		}
+	}
+	catch (invalid_argument e) {
+		cerr << e.what() << '\n';
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
\ No newline at end of file
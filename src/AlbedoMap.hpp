@@ -0,0 +1,55 @@
+#pragma once
+
+#include <vector>
+#include <cassert>
+
+
+// Owns its values, moving one moves them, see NormalMap.
+struct AlbedoMap {
+	// One value per pixel and channel, the fraction of the light the
+	// surface reflects. Within [0, 1] unless there are highlights.
+	// The channels of a pixel come one after another.
+	std::vector<double> albedoData;
+
+	std::size_t width;
+	std::size_t height;
+
+	// 1 for gray or 3 for RGB.
+	std::size_t nChannels;
+
+	AlbedoMap(
+		const std::size_t width,
+		const std::size_t height,
+		std::vector<double> albedoData,
+		const std::size_t nChannels = 1)
+		:
+		albedoData(std::move(albedoData)), width(width), height(height), nChannels(nChannels)
+	{
+		assert(this->albedoData.size() == width * height * nChannels);
+	}
+};
+
+
+// Values owned by someone else, see NormalMapView.
+struct AlbedoMapView {
+	const double* albedoData;
+	std::size_t width;
+	std::size_t height;
+	std::size_t nChannels;
+
+	AlbedoMapView(
+		const std::size_t width,
+		const std::size_t height,
+		const std::vector<double>& albedoData,
+		const std::size_t nChannels = 1)
+		:
+		albedoData(albedoData.data()), width(width), height(height), nChannels(nChannels)
+	{
+		assert(albedoData.size() >= width * height * nChannels);
+	}
+
+	AlbedoMapView(const AlbedoMap& albedoMap)
+		:
+		albedoData(albedoMap.albedoData.data()), width(albedoMap.width), height(albedoMap.height), nChannels(albedoMap.nChannels)
+	{}
+};
\ No newline at end of file
@@ -0,0 +1,81 @@
+#include "BackgroundWriter.hpp"
+#include "trace.hpp"
+using std::size_t;
+using std::function;
+using std::mutex;
+using std::lock_guard;
+using std::unique_lock;
+using std::exception_ptr;
+using std::rethrow_exception;
+using std::current_exception;
+
+
+BackgroundWriter::BackgroundWriter(const size_t capacity)
+	:
+	capacity(capacity)
+{
+	thread = std::thread{ [this] { loop(); } };
+}
+
+
+BackgroundWriter::~BackgroundWriter() {
+	close();
+}
+
+
+void BackgroundWriter::post(function<void()> write) {
+	unique_lock<mutex> lock{ queueMutex };
+	queueChanged.wait(lock, [this] { return queue.size() < capacity || error; });
+	if (error) rethrow_exception(error);
+
+	queue.push_back(std::move(write));
+	queueChanged.notify_all();
+}
+
+
+void BackgroundWriter::finish() {
+	close();
+
+	const lock_guard<mutex> lock{ queueMutex };
+	if (error) rethrow_exception(error);
+}
+
+
+void BackgroundWriter::loop() {
+	traceThreadName("writer");
+
+	unique_lock<mutex> lock{ queueMutex };
+	while (true) {
+		queueChanged.wait(lock, [this] { return !queue.empty() || closing; });
+		if (queue.empty()) return;
+
+		// Stays in the queue while it runs, so it counts for capacity.
+		function<void()>& write = queue.front();
+		if (!error) {
+			lock.unlock();
+			exception_ptr failure;
+			try {
+				write();
+			}
+			catch (...) {
+				failure = current_exception();
+			}
+			lock.lock();
+			if (failure) error = failure;
+		}
+		queue.pop_front();
+		queueChanged.notify_all();
+	}
+}
+
+
+void BackgroundWriter::close() {
+	{
+		const lock_guard<mutex> lock{ queueMutex };
+		closing = true;
+	}
+	queueChanged.notify_all();
+	if (thread.joinable()) {
+		thread.join();
+	}
+}
\ No newline at end of file
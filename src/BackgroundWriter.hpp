@@ -0,0 +1,46 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+#include <thread>
+
+
+// Runs writes one after another on a thread of its own, so encoding
+// results overlaps with calculating the next ones. At most capacity
+// writes wait at a time, beyond that post blocks, so the memory of
+// the waiting results stays bounded. After a write failed, the rest
+// are dropped and the error comes out of post or finish.
+class BackgroundWriter {
+public:
+	explicit BackgroundWriter(const std::size_t capacity = 2);
+
+	// Waits for the writes that are already posted.
+	~BackgroundWriter();
+
+	BackgroundWriter(const BackgroundWriter&) = delete;
+	BackgroundWriter& operator=(const BackgroundWriter&) = delete;
+
+
+	void post(std::function<void()> write);
+
+
+	// Waits until all writes are done.
+	void finish();
+
+private:
+	const std::size_t capacity;
+
+	std::deque<std::function<void()>> queue;
+	bool closing = false;
+	std::exception_ptr error;
+	std::mutex queueMutex;
+	std::condition_variable queueChanged;
+
+	std::thread thread;
+
+	void loop();
+	void close();
+};
\ No newline at end of file
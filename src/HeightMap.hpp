@@ -0,0 +1,24 @@
+#pragma once
+
+#include <vector>
+#include <cassert>
+
+
+// Owns its heights, moving one moves them, see NormalMap.
+struct HeightMap {
+	// One height per pixel, in pixels, relative to the mean height.
+	std::vector<float> heightData;
+
+	std::size_t width;
+	std::size_t height;
+
+	HeightMap(
+		const std::size_t width,
+		const std::size_t height,
+		std::vector<float> heightData)
+		:
+		heightData(std::move(heightData)), width(width), height(height)
+	{
+		assert(this->heightData.size() == width * height);
+	}
+};
\ No newline at end of file
@@ -0,0 +1,55 @@
+#include "LightStack.hpp"
+using std::size_t;
+using std::uint8_t;
+using std::uint16_t;
+
+#include <stdexcept>
+using std::invalid_argument;
+
+#include <algorithm>
+using std::min;
+
+
+template<typename Sample>
+void LightStack<Sample>::insert(const ReflectionMap<Sample>& map) {
+	if (map.width != width || map.height != height) {
+		throw invalid_argument("The files are not the same size!");
+	}
+	if (lightDirections.size() == nLights) {
+		throw invalid_argument("The stack is already full.");
+	}
+
+	const size_t k = lightDirections.size();
+	lightDirections.push_back(map.incidentIlluminationDirection());
+
+	const Sample* src = &map.intensities[0];
+
+	for (size_t y = 0; y < height; ++y, src += width) {
+		setRow(k, y, src);
+	}
+}
+
+
+template<typename Sample>
+void LightStack<Sample>::setRow(const size_t k, const size_t y, const Sample* values) {
+	assert(k < nLights);
+	assert(y < height);
+	assert(!external);
+
+	Sample* row = &samples[y * stride * nLights];
+
+	for (size_t x = 0; x < width; x += BLOCK_WIDTH) {
+		const size_t n = min(BLOCK_WIDTH, width - x);
+		Sample* dst = row + x * nLights + k * BLOCK_WIDTH;
+
+		for (size_t i = 0; i < n; ++i) {
+			dst[i] = *values++;
+		}
+	}
+}
+
+
+template struct LightStack<uint8_t>;
+template struct LightStack<uint16_t>;
+template struct LightStack<Half>;
+template struct LightStack<float>;
\ No newline at end of file
@@ -0,0 +1,122 @@
+#pragma once
+
+#include "ReflectionMap.hpp"
+#include "Sample.hpp"
+#include "Vec.hpp"
+
+#include <vector>
+#include <utility>
+#include <memory>
+#include <cassert>
+
+
+// All reflection-maps of a dataset in one buffer. Each row is
+// split into blocks of BLOCK_WIDTH pixels and every block holds
+// the samples of all lights for its pixels, one light after
+// another. The samples of a pixel are BLOCK_WIDTH apart and
+// a block is a single contiguous piece of memory, so walking
+// along a row streams through the buffer sequentially.
+// A stack can also hold only a band of rows of the images,
+// starting at firstRow. Or it can be a view of samples that live
+// somewhere else, like in a mapped cache file.
+template<typename Sample>
+struct LightStack {
+	static constexpr std::size_t BLOCK_WIDTH = 16;
+
+	const std::size_t width;
+	const std::size_t height;
+	const std::size_t nLights;
+
+	// Row of the images the first row of this stack is.
+	const std::size_t firstRow;
+
+	// The width rounded up to a multiple of BLOCK_WIDTH.
+	// Samples of the padding are zero.
+	const std::size_t stride;
+
+	// All intensities are within the interval [0, 1] after scaling,
+	// see SampleTraits.
+	std::vector<Sample> samples;
+
+	// The direction to the light-source for each light.
+	std::vector<Vec3> lightDirections;
+
+	// Set if the samples are not in samples but there, in the same
+	// layout. The owner keeps that memory alive, e.g. a MappedFile.
+	const Sample* external = nullptr;
+	std::shared_ptr<const void> externalOwner;
+
+	// The samples are kept in storage, so the memory of a stack
+	// that isn't needed anymore can be reused for a new one.
+	LightStack(
+		const std::size_t width,
+		const std::size_t height,
+		const std::size_t nLights,
+		const std::size_t firstRow = 0,
+		std::vector<Sample> storage = {})
+		:
+		width(width),
+		height(height),
+		nLights(nLights),
+		firstRow(firstRow),
+		stride(strideFor(width)),
+		samples(std::move(storage))
+	{
+		samples.assign(stride * height * nLights, SampleTraits<Sample>::fromUnit(0.0));
+		lightDirections.reserve(nLights);
+	}
+
+
+	// A view of the samples at external, nothing is copied.
+	LightStack(
+		const std::size_t width,
+		const std::size_t height,
+		const std::size_t nLights,
+		const Sample* external,
+		std::shared_ptr<const void> externalOwner)
+		:
+		width(width),
+		height(height),
+		nLights(nLights),
+		firstRow(0),
+		stride(strideFor(width)),
+		external(external),
+		externalOwner(std::move(externalOwner))
+	{
+		lightDirections.reserve(nLights);
+	}
+
+
+	// All samples, stride * height * nLights of them.
+	const Sample* data() const {
+		return external ? external : &samples[0];
+	}
+
+
+	static constexpr std::size_t strideFor(const std::size_t width) {
+		return (width + BLOCK_WIDTH - 1) / BLOCK_WIDTH * BLOCK_WIDTH;
+	}
+
+
+	// Returns the block containing the pixel (x, y). The sample of
+	// light k for this pixel is at [k * BLOCK_WIDTH + x % BLOCK_WIDTH].
+	const Sample* block(const std::size_t x, const std::size_t y) const {
+		assert(x < width);
+		assert(y < height);
+		return data() + (y * stride + x - x % BLOCK_WIDTH) * nLights;
+	}
+
+
+	Sample at(const std::size_t x, const std::size_t y, const std::size_t k) const {
+		assert(k < nLights);
+		return block(x, y)[k * BLOCK_WIDTH + x % BLOCK_WIDTH];
+	}
+
+
+	// Copies the intensities of the map into the slot of the next light.
+	void insert(const ReflectionMap<Sample>& map);
+
+
+	// Copies width values into row y of light k.
+	void setRow(const std::size_t k, const std::size_t y, const Sample* values);
+};
\ No newline at end of file
@@ -0,0 +1,82 @@
+#include "MappedFile.hpp"
+using std::string;
+using std::size_t;
+
+#include <stdexcept>
+using std::invalid_argument;
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+
+#if defined(_WIN32)
+
+MappedFile::MappedFile(const string& file) {
+	fileHandle = CreateFileA(file.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (fileHandle == INVALID_HANDLE_VALUE) {
+		fileHandle = nullptr;
+		throw invalid_argument{ "Cannot open file: " + file };
+	}
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0) {
+		CloseHandle(fileHandle);
+		throw invalid_argument{ "Cannot map file: " + file };
+	}
+	nBytes = static_cast<size_t>(fileSize.QuadPart);
+
+	mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	const void* view = mappingHandle ? MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0) : nullptr;
+	if (!view) {
+		if (mappingHandle) CloseHandle(mappingHandle);
+		CloseHandle(fileHandle);
+		throw invalid_argument{ "Cannot map file: " + file };
+	}
+	bytes = static_cast<const unsigned char*>(view);
+}
+
+
+MappedFile::~MappedFile() {
+	UnmapViewOfFile(bytes);
+	CloseHandle(mappingHandle);
+	CloseHandle(fileHandle);
+}
+
+#else
+
+MappedFile::MappedFile(const string& file) {
+	const int fd = open(file.c_str(), O_RDONLY);
+	if (fd < 0) throw invalid_argument{ "Cannot open file: " + file };
+
+	struct stat status;
+	if (fstat(fd, &status) != 0 || status.st_size == 0) {
+		close(fd);
+		throw invalid_argument{ "Cannot map file: " + file };
+	}
+	nBytes = static_cast<size_t>(status.st_size);
+
+	// The mapping stays valid after closing the file.
+	void* view = mmap(nullptr, nBytes, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (view == MAP_FAILED) throw invalid_argument{ "Cannot map file: " + file };
+	bytes = static_cast<const unsigned char*>(view);
+}
+
+
+MappedFile::~MappedFile() {
+	munmap(const_cast<unsigned char*>(bytes), nBytes);
+}
+
+#endif
\ No newline at end of file
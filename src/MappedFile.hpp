@@ -0,0 +1,28 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+
+
+// A whole file mapped read-only into memory, POSIX or Windows.
+// Pages are only read from disk when they are touched.
+class MappedFile {
+public:
+	explicit MappedFile(const std::string& file);
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	const unsigned char* data() const { return bytes; }
+	std::size_t size() const { return nBytes; }
+
+private:
+	const unsigned char* bytes = nullptr;
+	std::size_t nBytes = 0;
+
+#if defined(_WIN32)
+	void* fileHandle = nullptr;
+	void* mappingHandle = nullptr;
+#endif
+};
\ No newline at end of file
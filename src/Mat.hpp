@@ -2,43 +2,169 @@
 
 #include "Vec.hpp"
 
-#include <vector>
+#include <array>
+#include <cmath>
+#include <cstddef>
 #include <cassert>
+#include <utility>
 
 
+// Fixed-size matrix in row-major order. Like Vec it lives
+// on the stack and never allocates.
+template<std::size_t M, std::size_t N>
 struct Mat {
-	const std::size_t M;
-	const std::size_t N;
-	const std::vector<double> data;
+	std::array<double, M * N> data;
 
 
-	Mat(std::size_t M, std::size_t N, const std::vector<double> & data)
-		: M(M), N(N), data(data)
-	{
-		assert(data.size() == M * N);
+	constexpr double at(const std::size_t m, const std::size_t n) const {
+		assert(m < M);
+		assert(n < N);
+		return data[m * N + n];
 	}
 
 
-	Mat(const double x_11, const double x_12, const double x_13,
-		const double x_21, const double x_22, const double x_23,
-		const double x_31, const double x_32, const double x_33)
-		:
-		Mat(3, 3, std::vector<double>{x_11, x_12, x_13, x_21, x_22, x_23, x_31, x_32, x_33}) {}
+	constexpr double& at(const std::size_t m, const std::size_t n) {
+		assert(m < M);
+		assert(n < N);
+		return data[m * N + n];
+	}
 
 
-	double at(const int m, const int n) const {
-		assert(m < M && m >= 0);
-		assert(n < N && n >= 0);
-		return data[m * N + n];
+	constexpr Mat<N, M> transpose() const {
+		Mat<N, M> t{};
+		for (std::size_t i = 0; i < M; ++i) {
+			for (std::size_t j = 0; j < N; ++j) {
+				t.at(j, i) = at(i, j);
+			}
+		}
+		return t;
 	}
 
 
-	Mat transpose() const;
 	Mat inverse() const;
 
 	static Mat rotationX(const double radX);
-	static Mat rotationY(const double radX);
+	static Mat rotationY(const double radY);
+
+
+	template<std::size_t P>
+	constexpr Mat<M, P> operator*(const Mat<N, P>& other) const {
+		Mat<M, P> result{};
+		for (std::size_t i = 0; i < M; ++i) {
+			for (std::size_t j = 0; j < P; ++j) {
+				double sum = 0.0;
+				for (std::size_t k = 0; k < N; ++k) { // k for summation
+					sum += at(i, k) * other.at(k, j);
+				}
+				result.at(i, j) = sum;
+			}
+		}
+		return result;
+	}
+
+
+	constexpr Vec<M> operator*(const Vec<N>& v) const {
+		Vec<M> result{};
+		for (std::size_t i = 0; i < M; ++i) {
+			double sum = 0.0;
+			for (std::size_t k = 0; k < N; ++k) {
+				sum += at(i, k) * v[k];
+			}
+			result[i] = sum;
+		}
+		return result;
+	}
+};
+
+
+using Mat3 = Mat<3, 3>;
+
+
+// You don't need to read this, just believe in it.
+// TODO proper documentation
+template<std::size_t M, std::size_t N>
+Mat<M, N> Mat<M, N>::inverse() const {
+	static_assert(M == N, "Only square matrices can be inverted.");
+	// TODO check determinant
+
+	// Gauss-Jordan on [left | right], right starts as the unit-matrix
+	Mat left = *this;
+	Mat right{};
+	for (std::size_t i = 0; i < N; ++i) {
+		right.at(i, i) = 1.0;
+	}
+
+	for (std::size_t i = 0; i < N; ++i) { // i: rows from top to bottom
+		double fac = left.at(i, i);
+
+		std::size_t swapRow = i;
+		while (fac == 0.0) { // find row to swap current with if necessary
+			++swapRow;
+			fac = left.at(swapRow, i);
+		}
+		if (swapRow != i) {
+			for (std::size_t j = 0; j < N; ++j) {
+				std::swap(left.at(swapRow, j), left.at(i, j));
+				std::swap(right.at(swapRow, j), right.at(i, j));
+			}
+		}
+
+		for (std::size_t j = 0; j < N; ++j) { // normalize current row based on (i, i)
+			left.at(i, j) /= fac;
+			right.at(i, j) /= fac;
+		}
+
+		for (std::size_t k = i + 1; k < N; ++k) { // k: rows from i to bottom
+			const double val = left.at(k, i); // value to neutralize, i.e. making (k, i) zero
+			for (std::size_t l = 0; l < N; ++l) { // subtract i-row * val from k-row
+				left.at(k, l) -= left.at(i, l) * val;
+				right.at(k, l) -= right.at(i, l) * val;
+			}
+		}
+	}
+
+	// at this point we have a matrix with zeros under the diagonal
+	// and 1s at the diagonal
+
+	for (std::size_t i = N - 1; i > 0; --i) { // i: rows from bottom to top
+		for (std::size_t k = i; k-- > 0;) { // k: rows from i to top
+			const double val = left.at(k, i); // value to neutralize, i.e. making (k, i) zero
+			for (std::size_t l = 0; l < N; ++l) { // subtract i-row * val from k-row
+				left.at(k, l) -= left.at(i, l) * val;
+				right.at(k, l) -= right.at(i, l) * val;
+			}
+		}
+	}
+
+	// at this point left became the unit-matrix and right the inverse
+
+	return right;
+}
+
+
+template<std::size_t M, std::size_t N>
+Mat<M, N> Mat<M, N>::rotationX(const double radX) {
+	static_assert(M == 3 && N == 3, "Rotations are 3x3.");
+	const double cos_radX = std::cos(radX);
+	const double sin_radX = std::sin(radX);
+
+	return Mat{
+		1.0, 0.0,		0.0,
+		0.0, cos_radX,	-sin_radX,
+		0.0, sin_radX,	cos_radX
+	};
+}
+
+
+template<std::size_t M, std::size_t N>
+Mat<M, N> Mat<M, N>::rotationY(const double radY) {
+	static_assert(M == 3 && N == 3, "Rotations are 3x3.");
+	const double cos_radY = std::cos(radY);
+	const double sin_radY = std::sin(radY);
 
-	Mat operator*(const Mat& other) const;
-	Vec operator*(const Vec& v) const;
-};
\ No newline at end of file
+	return Mat{
+		cos_radY,	0.0, sin_radY,
+		0.0,		1.0, 0.0,
+		-sin_radY,	0.0, cos_radY
+	};
+}
\ No newline at end of file
@@ -8,11 +8,10 @@ using std::sqrt;
 #include <cassert>
 
 
-bool allNormalized(const vector<double>& data) {
-	const size_t n = data.size();
+bool allNormalized(const double* data, const size_t n) {
 	assert(n % 3 == 0);
 
-	const double* x_p = &data[0];
+	const double* x_p = data;
 	const double* y_p = x_p + 1;
 	const double* z_p = y_p + 1;
 	const double* end = x_p + (n);
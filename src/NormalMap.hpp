@@ -6,25 +6,52 @@
 #include <cassert>
 
 
-bool allNormalized(const std::vector<double>& data);
+bool allNormalized(const double* data, const std::size_t n);
 
 
+// Owns its normals. Moving one moves the normals, it never copies
+// them, so pass the vector in with std::move where it isn't needed
+// anymore.
 struct NormalMap {
 	// Stores all (x, y, z) one after another.
 	// All values are within the interval [-1, 1].
-	const std::vector<double> normalsData;
+	std::vector<double> normalsData;
 
-	const std::size_t width;
-	const std::size_t height;
+	std::size_t width;
+	std::size_t height;
 
 	NormalMap(
 		const std::size_t width,
 		const std::size_t height,
-		const std::vector<double>& normalsData)
+		std::vector<double> normalsData)
 		:
-		width(width), height(height), normalsData(normalsData)
+		normalsData(std::move(normalsData)), width(width), height(height)
 	{
-		assert(normalsData.size() == width * height * 3);
-		assert(allNormalized(normalsData));
+		assert(this->normalsData.size() == width * height * 3);
+		assert(allNormalized(this->normalsData.data(), this->normalsData.size()));
 	}
+};
+
+
+// Normals owned by someone else, e.g. a band of a buffer that is
+// reused. What writes or integrates normals takes one of these, so
+// nothing has to be copied into a NormalMap just to be passed on.
+// The owner has to outlive the view.
+struct NormalMapView {
+	const double* normalsData;
+	std::size_t width;
+	std::size_t height;
+
+	NormalMapView(const std::size_t width, const std::size_t height, const std::vector<double>& normalsData)
+		:
+		normalsData(normalsData.data()), width(width), height(height)
+	{
+		assert(normalsData.size() >= width * height * 3);
+		assert(allNormalized(this->normalsData, width * height * 3));
+	}
+
+	NormalMapView(const NormalMap& normalMap)
+		:
+		normalsData(normalMap.normalsData.data()), width(normalMap.width), height(normalMap.height)
+	{}
 };
\ No newline at end of file
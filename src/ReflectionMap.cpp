@@ -4,9 +4,9 @@ using std::sin;
 using std::cos;
 
 
-Vec ReflectionMap::incidentIlluminationDirection() const {
+Vec3 incidentIlluminationDirection(const double azimuthalAngle, const double polarAngle) {
 	const double sin_polarAngle = sin(polarAngle);
-	return Vec{
+	return Vec3{
 		sin_polarAngle	* cos(azimuthalAngle),
 		sin_polarAngle	* sin(azimuthalAngle),
 		cos(polarAngle)
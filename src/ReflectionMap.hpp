@@ -1,54 +1,62 @@
 #pragma once
 
-#include "Mat.hpp"
 #include "Vec.hpp"
-#include "util.hpp"
+#include "Sample.hpp"
 
 #include <vector>
 #include <cassert>
 
 
+// Direction to a lamp given in spherical coordinates.
+Vec3 incidentIlluminationDirection(const double azimuthalAngle, const double polarAngle);
+
+
 // Represents an image taken with the material-scanner
 // with one lamp turned on. The attributes azimuthalAngle
 // and polarAngle describe the direction to the lamp from
-// the center of the ground.
+// the center of the ground. Owns its intensities, moving one
+// moves them, see NormalMap.
+template<typename Sample>
 struct ReflectionMap {
-	// All intensities are within the interval [0, 1].
-	const std::vector<double> intensities;
+	// All intensities are within the interval [0, 1] after scaling,
+	// see SampleTraits.
+	std::vector<Sample> intensities;
 
-	const std::size_t width;
-	const std::size_t height;
+	std::size_t width;
+	std::size_t height;
 
 	// Search for "spherical coordinate system".
-	const double azimuthalAngle;
-	const double polarAngle;
+	double azimuthalAngle;
+	double polarAngle;
 
 	ReflectionMap(
 		const std::size_t width,
 		const std::size_t height,
-		const std::vector<double>& intensities,
+		std::vector<Sample> intensities,
 		const double azimuthalAngle,
 		const double polarAngle)
 		:
+		intensities(std::move(intensities)),
 		width(width),
 		height(height),
-		intensities(intensities),
 		azimuthalAngle(azimuthalAngle),
 		polarAngle(polarAngle)
 	{
-		assert(intensities.size() == width * height);
-		assert(allSmallerEqualTo(intensities, 1.0));
+		assert(this->intensities.size() == width * height);
+		assert(allUnit(this->intensities));
 	}
 
 
 	// If you want to iterate all, then rather use a pointer/iterator.
-	double at(const int x, const int y) const {
-		assert(x < width && x >= 0);
-		assert(y < height && y >= 0);
+	Sample at(const std::size_t x, const std::size_t y) const {
+		assert(x < width);
+		assert(y < height);
 		return intensities[y * width + x];
 	}
 
 
 	// Returns the direction to the light-source.
-	Vec incidentIlluminationDirection() const;
+	Vec3 incidentIlluminationDirection() const {
+		return ::incidentIlluminationDirection(azimuthalAngle, polarAngle);
+	}
 };
\ No newline at end of file
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <vector>
+
+
+// A sample is the intensity of one pixel under one lamp. Samples are
+// kept in a compact type in memory and only the solver maps them into
+// the interval [0, 1], by multiplying with SampleTraits<Sample>::scale.
+
+
+// IEEE 754 half-precision float. Only used for storage.
+struct Half {
+	std::uint16_t bits;
+};
+
+
+inline float toFloat(const Half h) {
+	const std::uint32_t sign = static_cast<std::uint32_t>(h.bits & 0x8000) << 16;
+	const std::uint32_t exponent = (h.bits >> 10) & 0x1f;
+	const std::uint32_t mantissa = h.bits & 0x3ff;
+
+	if (exponent == 0) { // zero and subnormals
+		const float f = std::ldexp(static_cast<float>(mantissa), -24);
+		return sign ? -f : f;
+	}
+
+	const std::uint32_t bits = exponent == 0x1f
+		? sign | 0x7f800000 | (mantissa << 13) // inf and NaN
+		: sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+
+	float f;
+	std::memcpy(&f, &bits, sizeof f);
+	return f;
+}
+
+
+// Rounds to the nearest half, ties to even.
+inline Half toHalf(const float f) {
+	std::uint32_t bits;
+	std::memcpy(&bits, &f, sizeof bits);
+
+	const std::uint32_t sign = (bits >> 16) & 0x8000;
+	const std::int32_t exponent = static_cast<std::int32_t>((bits >> 23) & 0xff) - 127 + 15;
+	std::uint32_t mantissa = bits & 0x7fffff;
+
+	std::uint32_t half;
+	std::uint32_t rest;
+	std::uint32_t halfway;
+
+	if (((bits >> 23) & 0xff) == 0xff) { // inf and NaN
+		return Half{ static_cast<std::uint16_t>(sign | 0x7c00 | (mantissa ? 0x200 : 0)) };
+	}
+	else if (exponent >= 0x1f) { // too large, becomes inf
+		return Half{ static_cast<std::uint16_t>(sign | 0x7c00) };
+	}
+	else if (exponent <= 0) { // subnormal in half
+		if (exponent < -10) {
+			return Half{ static_cast<std::uint16_t>(sign) };
+		}
+		mantissa |= 0x800000;
+		const std::uint32_t shift = 14 - exponent;
+		half = sign | (mantissa >> shift);
+		rest = mantissa & ((1u << shift) - 1);
+		halfway = 1u << (shift - 1);
+	}
+	else {
+		half = sign | (static_cast<std::uint32_t>(exponent) << 10) | (mantissa >> 13);
+		rest = mantissa & 0x1fff;
+		halfway = 0x1000;
+	}
+
+	// A carry out of the mantissa correctly increments the exponent.
+	if (rest > halfway || (rest == halfway && (half & 1))) {
+		++half;
+	}
+	return Half{ static_cast<std::uint16_t>(half) };
+}
+
+
+enum class SampleFormat { UInt8, UInt16, Half, Float };
+
+
+template<typename Sample>
+struct SampleTraits;
+
+
+template<>
+struct SampleTraits<std::uint8_t> {
+	static constexpr SampleFormat format = SampleFormat::UInt8;
+	static constexpr double scale = 1.0 / 255;
+	static std::uint8_t fromUnit(const double v) { return static_cast<std::uint8_t>(std::lround(v * 255)); }
+	static double toUnit(const std::uint8_t s) { return s * scale; }
+};
+
+
+template<>
+struct SampleTraits<std::uint16_t> {
+	static constexpr SampleFormat format = SampleFormat::UInt16;
+	static constexpr double scale = 1.0 / 65535;
+	static std::uint16_t fromUnit(const double v) { return static_cast<std::uint16_t>(std::lround(v * 65535)); }
+	static double toUnit(const std::uint16_t s) { return s * scale; }
+};
+
+
+template<>
+struct SampleTraits<Half> {
+	static constexpr SampleFormat format = SampleFormat::Half;
+	static constexpr double scale = 1.0;
+	static Half fromUnit(const double v) { return toHalf(static_cast<float>(v)); }
+	static double toUnit(const Half s) { return toFloat(s); }
+};
+
+
+template<>
+struct SampleTraits<float> {
+	static constexpr SampleFormat format = SampleFormat::Float;
+	static constexpr double scale = 1.0;
+	static float fromUnit(const double v) { return static_cast<float>(v); }
+	static double toUnit(const float s) { return s; }
+};
+
+
+// True if all samples are within the interval [0, 1] after scaling.
+template<typename Sample>
+bool allUnit(const std::vector<Sample>& samples) {
+	for (const Sample s : samples) {
+		const double d = SampleTraits<Sample>::toUnit(s);
+		if (!(d >= 0.0 && d <= 1.0)) {
+			return false;
+		}
+	}
+	return true;
+}
\ No newline at end of file
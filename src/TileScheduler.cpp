@@ -0,0 +1,104 @@
+#include "TileScheduler.hpp"
+#include "util.hpp"
+using std::size_t;
+using std::function;
+using std::vector;
+using std::future;
+using std::mutex;
+using std::lock_guard;
+using std::unique_lock;
+
+#include <algorithm>
+using std::min;
+
+
+TileScheduler::TileScheduler(const size_t width, const size_t height, const bool allRowsAvailable)
+	:
+	width(width),
+	height(height),
+	tilesPerRow((width + TILE_WIDTH - 1) / TILE_WIDTH),
+	nTiles(tilesPerRow * ((height + TILE_HEIGHT - 1) / TILE_HEIGHT)),
+	availableRows(allRowsAvailable ? height : 0),
+	rowPublished(allRowsAvailable ? 0 : height, false)
+{}
+
+
+void TileScheduler::publishRows(const size_t begin, const size_t end) {
+	{
+		const lock_guard<mutex> lock{ rowsMutex };
+		for (size_t y = begin; y < end; ++y) {
+			rowPublished[y] = true;
+		}
+
+		// Rows can be published out of order, but only
+		// an unbroken run from the top is available.
+		size_t available = availableRows;
+		while (available < height && rowPublished[available]) {
+			++available;
+		}
+		availableRows = available;
+	}
+	rowsChanged.notify_all();
+}
+
+
+void TileScheduler::cancel() {
+	{
+		const lock_guard<mutex> lock{ rowsMutex };
+		cancelled = true;
+	}
+	rowsChanged.notify_all();
+}
+
+
+bool TileScheduler::waitForRows(const size_t end) {
+	if (availableRows >= end) {
+		return true;
+	}
+	unique_lock<mutex> lock{ rowsMutex };
+	rowsChanged.wait(lock, [this, end] { return cancelled || availableRows >= end; });
+	return !cancelled;
+}
+
+
+void TileScheduler::work(const function<void(const Tile&)>& fn) {
+	for (size_t t = nextTile++; t < nTiles; t = nextTile++) {
+		const size_t tileX = t % tilesPerRow;
+		const size_t tileY = t / tilesPerRow;
+
+		Tile tile;
+		tile.xBegin = tileX * TILE_WIDTH;
+		tile.xEnd = min(tile.xBegin + TILE_WIDTH, width);
+		tile.yBegin = tileY * TILE_HEIGHT;
+		tile.yEnd = min(tile.yBegin + TILE_HEIGHT, height);
+
+		if (!waitForRows(tile.yEnd)) {
+			return;
+		}
+		fn(tile);
+	}
+}
+
+
+void TileScheduler::run(ThreadPool& pool, const unsigned int nWorkers, const function<void(const Tile&)>& fn) {
+	vector<future<void>> workers;
+	workers.reserve(nWorkers);
+
+	for (unsigned int i = 0; i < nWorkers; ++i) {
+		workers.push_back(pool.enqueue([this, &fn] { work(fn); }));
+	}
+
+	// The calling thread would only wait otherwise.
+	try {
+		work(fn);
+	}
+	catch (...) {
+		cancel();
+		for (future<void>& f : workers) {
+			f.wait();
+		}
+		throw;
+	}
+
+	waitAll(workers);
+}
\ No newline at end of file
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "LightStack.hpp"
+
+#include "../submodules/ThreadPool/ThreadPool.h"
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <vector>
+
+
+// A rectangle of pixels, [xBegin, xEnd) x [yBegin, yEnd).
+struct Tile {
+	std::size_t xBegin;
+	std::size_t xEnd;
+	std::size_t yBegin;
+	std::size_t yEnd;
+};
+
+
+// Hands out the tiles of an image to workers through an atomic
+// counter. Every worker takes the next tile until none are left,
+// so fast workers simply take more tiles. Tiles are numbered row
+// by row, i.e. they are taken from top to bottom. Rows can also
+// become available over time (see publishRows), then a worker
+// waits until the rows of its tile are there.
+class TileScheduler {
+public:
+	// A tile of 256 x 16 pixels keeps its part of the per-column
+	// tables in the L1 cache while walking down its rows.
+	static constexpr std::size_t TILE_WIDTH = 256;
+	static constexpr std::size_t TILE_HEIGHT = 16;
+	static_assert(TILE_WIDTH % LightStack<float>::BLOCK_WIDTH == 0, "Tiles must not split blocks.");
+
+	// If allRowsAvailable is false, no rows are available
+	// until they get published.
+	TileScheduler(const std::size_t width, const std::size_t height, const bool allRowsAvailable = true);
+
+
+	// Makes the rows [begin, end) available.
+	void publishRows(const std::size_t begin, const std::size_t end);
+
+
+	// Wakes all waiting workers and makes them return.
+	void cancel();
+
+
+	// Runs fn on tiles until none are left.
+	// Call it from as many threads as you like.
+	void work(const std::function<void(const Tile&)>& fn);
+
+
+	// Runs work on nWorkers tasks on the pool and on the calling
+	// thread, and returns when all of them are done.
+	void run(ThreadPool& pool, const unsigned int nWorkers, const std::function<void(const Tile&)>& fn);
+
+private:
+	const std::size_t width;
+	const std::size_t height;
+	const std::size_t tilesPerRow;
+	const std::size_t nTiles;
+
+	std::atomic<std::size_t> nextTile{ 0 };
+
+	// Rows [0, availableRows) can be worked on.
+	std::atomic<std::size_t> availableRows;
+	bool cancelled = false;
+	std::vector<bool> rowPublished;
+	std::mutex rowsMutex;
+	std::condition_variable rowsChanged;
+
+	bool waitForRows(const std::size_t end);
+};
\ No newline at end of file
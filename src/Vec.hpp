@@ -1,24 +1,23 @@
 #pragma once
 
+#include <array>
 #include <cmath>
-#include <vector>
+#include <cstddef>
 
 
+// Fixed-size vector living on the stack, so it can be used
+// in the per-pixel code without allocating anything.
+template<std::size_t N>
 struct Vec {
-	const std::vector<double> data;
-	const std::size_t n;
+	static constexpr std::size_t n = N;
 
+	std::array<double, N> data;
 
-	Vec(const std::vector<double>& data, const std::size_t n) : data(data), n(n) {}
 
+	constexpr double operator[](const std::size_t i) const { return data[i]; }
 
-	Vec(const std::vector<double>& data) : Vec(data, data.size()) {}
 
-
-	Vec(const double x, const double y, const double z) : Vec(std::vector<double>{x, y, z}, 3) {}
-
-
-	double operator[](const int i) const { return data[i]; }
+	constexpr double& operator[](const std::size_t i) { return data[i]; }
 
 
 	double length() const {
@@ -33,14 +32,37 @@ struct Vec {
 	Vec normalize() const {
 		const double len = length();
 
-		std::vector<double> newData;
-		newData.reserve(n);
+		Vec newVec{};
+		for (std::size_t i = 0; i < N; ++i) {
+			newVec.data[i] = data[i] / len;
+		}
+		return newVec;
+	}
 
-		for (const double d : data) {
-			newData.push_back(d / len);
+
+	constexpr Vec& operator+=(const Vec& other) {
+		for (std::size_t i = 0; i < N; ++i) {
+			data[i] += other.data[i];
 		}
+		return *this;
+	}
+
 
-		return Vec{ newData };
+	constexpr Vec operator+(const Vec& other) const {
+		Vec v = *this;
+		v += other;
+		return v;
 	}
 
-};
\ No newline at end of file
+
+	constexpr Vec operator*(const double s) const {
+		Vec v = *this;
+		for (double& d : v.data) {
+			d *= s;
+		}
+		return v;
+	}
+};
+
+
+using Vec3 = Vec<3>;
\ No newline at end of file
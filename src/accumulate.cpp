@@ -0,0 +1,114 @@
+#include "accumulate.hpp"
+#include "TileScheduler.hpp"
+#include "Sample.hpp"
+#include "trace.hpp"
+using std::vector;
+using std::size_t;
+using std::uint8_t;
+using std::uint16_t;
+
+#include <stdexcept>
+using std::invalid_argument;
+
+#include <cmath>
+using std::sqrt;
+
+#include <cassert>
+
+
+Accumulator::Accumulator(const size_t width, const size_t height, const double correctionFactor)
+	:
+	width(width),
+	height(height),
+	correction(width, height, correctionFactor),
+	sums(width * height * 3, 0.0)
+{}
+
+
+template<typename Sample>
+void Accumulator::add(const ReflectionMap<Sample>& map, ThreadPool& pool, const unsigned int nWorkers) {
+	if (map.width != width || map.height != height) {
+		throw invalid_argument{ "The image is not the size of the others." };
+	}
+	add(&map.intensities[0], map.incidentIlluminationDirection(), pool, nWorkers);
+}
+
+
+template<typename Sample>
+void Accumulator::add(const Sample* intensities, const Vec3& l, ThreadPool& pool, const unsigned int nWorkers) {
+	const TraceSpan span{ "accumulate" };
+
+	TileScheduler{ width, height }.run(pool, nWorkers, [this, intensities, &l](const Tile& t) {
+		for (size_t y = t.yBegin; y < t.yEnd; ++y) {
+			for (size_t x = t.xBegin; x < t.xEnd; ++x) {
+				const size_t i = y * width + x;
+				const double I = SampleTraits<Sample>::toUnit(intensities[i]);
+				sums[i * 3] += l[0] * I;
+				sums[i * 3 + 1] += l[1] * I;
+				sums[i * 3 + 2] += l[2] * I;
+			}
+		}
+	});
+
+	for (int i = 0; i < 3; ++i) {
+		for (int j = 0; j < 3; ++j) {
+			L_transposedL.at(i, j) += l[i] * l[j];
+		}
+	}
+	++lights;
+}
+
+
+void Accumulator::finish(double* out, ThreadPool& pool, const unsigned int nWorkers, double* albedo) const {
+	if (lights < 3 || !invertible(L_transposedL)) {
+		throw invalid_argument{ "Needs at least 3 images with light-directions that don't lie in one plane." };
+	}
+	const TraceSpan span{ "solve" };
+	const Mat3 inverse = L_transposedL.inverse();
+
+	TileScheduler{ width, height }.run(pool, nWorkers, [this, out, albedo, &inverse](const Tile& tile) {
+		for (size_t y = tile.yBegin; y < tile.yEnd; ++y) {
+			const double cX = correction.cosX[y];
+			const double sX = correction.sinX[y];
+
+			for (size_t x = tile.xBegin; x < tile.xEnd; ++x) {
+				const size_t i = y * width + x;
+				const Vec3 n = inverse * Vec3{ sums[i * 3], sums[i * 3 + 1], sums[i * 3 + 2] };
+
+				// Corrected like in the kernel, see solveRow.
+				const double cY = correction.cosY[x];
+				const double sY = correction.sinY[x];
+				const double t = sY * n[0] - cY * n[2];
+				const double bx = cY * n[0] + sY * n[2];
+				const double by = sX * t + cX * n[1];
+				const double bz = sX * n[1] - cX * t;
+				const double length = sqrt(bx * bx + by * by + bz * bz);
+
+				out[i * 3] = bx / length;
+				out[i * 3 + 1] = by / length;
+				out[i * 3 + 2] = bz / length;
+				if (albedo) {
+					albedo[i] = length;
+				}
+			}
+		}
+	});
+}
+
+
+NormalMap Accumulator::finish(ThreadPool& pool, const unsigned int nWorkers) const {
+	vector<double> normalsData(width * height * 3);
+	finish(&normalsData[0], pool, nWorkers);
+	return NormalMap{ width, height, std::move(normalsData) };
+}
+
+
+template void Accumulator::add(const ReflectionMap<uint8_t>&, ThreadPool&, const unsigned int);
+template void Accumulator::add(const ReflectionMap<uint16_t>&, ThreadPool&, const unsigned int);
+template void Accumulator::add(const ReflectionMap<Half>&, ThreadPool&, const unsigned int);
+template void Accumulator::add(const ReflectionMap<float>&, ThreadPool&, const unsigned int);
+
+template void Accumulator::add(const uint8_t*, const Vec3&, ThreadPool&, const unsigned int);
+template void Accumulator::add(const uint16_t*, const Vec3&, ThreadPool&, const unsigned int);
+template void Accumulator::add(const Half*, const Vec3&, ThreadPool&, const unsigned int);
+template void Accumulator::add(const float*, const Vec3&, ThreadPool&, const unsigned int);
\ No newline at end of file
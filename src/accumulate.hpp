@@ -0,0 +1,57 @@
+#pragma once
+
+#include "solve.hpp"
+#include "ReflectionMap.hpp"
+#include "NormalMap.hpp"
+#include "Mat.hpp"
+#include "Vec.hpp"
+
+#include "../submodules/ThreadPool/ThreadPool.h"
+
+#include <vector>
+
+
+// Photometric stereo one image at a time. The least squares solution
+// (L^T * L)^-1 * L^T * I is (L^T * L)^-1 * sum of l_k * I_k over the
+// lights k, so every image is added to that sum as soon as it is
+// there, and only the inverse, the length and the correction are left
+// for the end. Needs 3 values per pixel instead of all images. There
+// is no rejection, leaving out shadows needs all samples of a pixel.
+class Accumulator {
+public:
+	const std::size_t width;
+	const std::size_t height;
+
+	Accumulator(const std::size_t width, const std::size_t height, const double correctionFactor);
+
+
+	// Adds the image of one more lamp, in parallel on nWorkers
+	// tasks of the pool and the calling thread.
+	template<typename Sample>
+	void add(const ReflectionMap<Sample>& map, ThreadPool& pool, const unsigned int nWorkers);
+
+	// Like above, for width * height intensities row by row, see SampleTraits.
+	template<typename Sample>
+	void add(const Sample* intensities, const Vec3& lightDirection, ThreadPool& pool, const unsigned int nWorkers);
+
+
+	std::size_t nLights() const { return lights; }
+
+
+	// Writes the normals of the images so far like Solver::solve, the
+	// albedo too unless it is null. Needs at least 3 lights, not in one
+	// plane. More images can be added afterwards.
+	void finish(double* out, ThreadPool& pool, const unsigned int nWorkers, double* albedo = nullptr) const;
+
+	NormalMap finish(ThreadPool& pool, const unsigned int nWorkers) const;
+
+private:
+	const Correction correction;
+
+	// Sum of the outer products of the light-directions so far.
+	Mat3 L_transposedL{};
+	std::size_t lights = 0;
+
+	// Sum of l_k * I_k per pixel, (x, y, z) one after another.
+	std::vector<double> sums;
+};
\ No newline at end of file
@@ -0,0 +1,255 @@
+#include "cache.hpp"
+#include "MappedFile.hpp"
+#include "io.hpp"
+#include "trace.hpp"
+using std::string;
+using std::vector;
+using std::size_t;
+using std::uint8_t;
+using std::uint16_t;
+using std::uint32_t;
+using std::uint64_t;
+using std::optional;
+using std::nullopt;
+
+#include <stdexcept>
+using std::invalid_argument;
+
+#include <filesystem>
+using std::filesystem::path;
+using std::filesystem::exists;
+using std::filesystem::file_size;
+using std::filesystem::last_write_time;
+using std::filesystem::create_directories;
+using std::filesystem::rename;
+using std::filesystem::remove;
+
+#include <fstream>
+using std::ofstream;
+
+#include <sstream>
+using std::stringstream;
+
+#include <algorithm>
+using std::sort;
+
+#include <memory>
+using std::shared_ptr;
+using std::make_shared;
+
+#include <functional>
+using std::hash;
+
+#include <random>
+using std::random_device;
+
+#include <chrono>
+using std::chrono::steady_clock;
+
+#include <cstring>
+using std::memcmp;
+using std::memcpy;
+
+#include <cassert>
+
+
+const char MAGIC[8] = { 'M', 'S', 'H', 'C', 'A', 'C', 'H', 'E' };
+const uint32_t VERSION = 1;
+
+// The samples start at a multiple of this, so SIMD-loads
+// from them are as aligned as from a vector.
+const uint64_t SAMPLES_ALIGNMENT = 64;
+
+
+// Followed by the light-directions as nLights * 3 doubles, the
+// signature and, at samplesOffset, the samples.
+struct CacheHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t sampleFormat;
+	uint64_t sampleSize;
+	uint64_t blockWidth;
+	uint64_t width;
+	uint64_t height;
+	uint64_t nLights;
+	uint64_t signatureSize;
+	uint64_t samplesOffset;
+};
+
+
+string datasetSignature(const string& datasetDirectory) {
+	vector<string> lines;
+	for (const string& item : listItems(datasetDirectory)) {
+		std::error_code error;
+		const uint64_t size = file_size(item, error);
+		const auto modified = last_write_time(item, error).time_since_epoch().count();
+		lines.push_back(path{ item }.filename().string() + '\t' + std::to_string(size) + '\t' + std::to_string(modified));
+	}
+	sort(lines.begin(), lines.end());
+
+	stringstream signature;
+	signature << std::filesystem::absolute(datasetDirectory).lexically_normal().string() << '\n';
+	for (const string& line : lines) {
+		signature << line << '\n';
+	}
+	return signature.str();
+}
+
+
+string formatName(const SampleFormat format) {
+	switch (format) {
+	case SampleFormat::UInt8: return "u8";
+	case SampleFormat::Half: return "f16";
+	case SampleFormat::Float: return "f32";
+	default: return "u16";
+	}
+}
+
+
+// One file per dataset and sample-format.
+template<typename Sample>
+path cacheFile(const string& cacheDirectory, const string& datasetDirectory) {
+	const string absolute = std::filesystem::absolute(datasetDirectory).lexically_normal().string();
+	stringstream name;
+	name << std::hex << hash<string>{}(absolute) << '_' << formatName(SampleTraits<Sample>::format) << ".msc";
+	return path{ cacheDirectory } / name.str();
+}
+
+
+uint64_t alignUp(const uint64_t n, const uint64_t alignment) {
+	return (n + alignment - 1) / alignment * alignment;
+}
+
+
+template<typename Sample>
+optional<LightStack<Sample>> loadCachedDataset(const string& cacheDirectory, const string& datasetDirectory, const string& signature) {
+	const TraceSpan span{ "cache" };
+
+	const path file = cacheFile<Sample>(cacheDirectory, datasetDirectory);
+	if (!exists(file)) return nullopt;
+
+	shared_ptr<const MappedFile> mapped;
+	try {
+		mapped = make_shared<const MappedFile>(file.string());
+	}
+	catch (invalid_argument) {
+		return nullopt;
+	}
+
+	const unsigned char* bytes = mapped->data();
+	const size_t size = mapped->size();
+
+	CacheHeader header;
+	if (size < sizeof header) return nullopt;
+	memcpy(&header, bytes, sizeof header);
+
+	const bool compatible =
+		memcmp(header.magic, MAGIC, sizeof MAGIC) == 0 &&
+		header.version == VERSION &&
+		header.sampleFormat == static_cast<uint32_t>(SampleTraits<Sample>::format) &&
+		header.sampleSize == sizeof(Sample) &&
+		header.blockWidth == LightStack<Sample>::BLOCK_WIDTH;
+	if (!compatible) return nullopt;
+
+	const uint64_t directionsOffset = sizeof header;
+	const uint64_t signatureOffset = directionsOffset + header.nLights * 3 * sizeof(double);
+	const uint64_t nSamples = LightStack<Sample>::strideFor(header.width) * header.height * header.nLights;
+	if (header.samplesOffset < signatureOffset + header.signatureSize ||
+		header.samplesOffset % SAMPLES_ALIGNMENT != 0 ||
+		size != header.samplesOffset + nSamples * sizeof(Sample)) {
+		return nullopt;
+	}
+
+	// Images changed, added or removed since the cache was made.
+	if (header.signatureSize != signature.size() ||
+		memcmp(bytes + signatureOffset, signature.data(), signature.size()) != 0) {
+		return nullopt;
+	}
+
+	const Sample* samples = reinterpret_cast<const Sample*>(bytes + header.samplesOffset);
+	LightStack<Sample> dataset{ header.width, header.height, header.nLights, samples, mapped };
+
+	for (uint64_t k = 0; k < header.nLights; ++k) {
+		double direction[3];
+		memcpy(direction, bytes + directionsOffset + k * sizeof direction, sizeof direction);
+		dataset.lightDirections.push_back(Vec3{ direction[0], direction[1], direction[2] });
+	}
+
+	traceCount("bytes read", size);
+	return dataset;
+}
+
+
+template<typename Sample>
+void storeCachedDataset(const LightStack<Sample>& dataset, const string& cacheDirectory, const string& datasetDirectory, const string& signature) {
+	assert(dataset.firstRow == 0);
+	const TraceSpan span{ "cache" };
+
+	std::error_code error;
+	create_directories(cacheDirectory, error);
+
+	CacheHeader header;
+	memcpy(header.magic, MAGIC, sizeof MAGIC);
+	header.version = VERSION;
+	header.sampleFormat = static_cast<uint32_t>(SampleTraits<Sample>::format);
+	header.sampleSize = sizeof(Sample);
+	header.blockWidth = LightStack<Sample>::BLOCK_WIDTH;
+	header.width = dataset.width;
+	header.height = dataset.height;
+	header.nLights = dataset.nLights;
+	header.signatureSize = signature.size();
+	header.samplesOffset = alignUp(sizeof header + dataset.nLights * 3 * sizeof(double) + signature.size(), SAMPLES_ALIGNMENT);
+
+	// Written next to it and renamed at the end, so a run that
+	// is cut off never leaves a broken cache-file behind. The name is
+	// random, so runs caching the same dataset at once never write
+	// into the same file, each renames a whole one.
+	const path file = cacheFile<Sample>(cacheDirectory, datasetDirectory);
+	random_device random;
+	const uint64_t suffix = (static_cast<uint64_t>(random()) << 32 | random())
+		^ static_cast<uint64_t>(steady_clock::now().time_since_epoch().count());
+	stringstream partialName;
+	partialName << '.' << std::hex << suffix << ".partial";
+	const path partial = path{ file }.concat(partialName.str());
+	{
+		ofstream out{ partial, std::ios::binary };
+		if (!out) throw invalid_argument{ "Cannot create file: " + partial.string() };
+
+		out.write(reinterpret_cast<const char*>(&header), sizeof header);
+		for (const Vec3& l : dataset.lightDirections) {
+			const double direction[3] = { l[0], l[1], l[2] };
+			out.write(reinterpret_cast<const char*>(direction), sizeof direction);
+		}
+		out.write(signature.data(), signature.size());
+
+		const vector<char> padding(header.samplesOffset - (sizeof header + dataset.nLights * 3 * sizeof(double) + signature.size()), 0);
+		out.write(padding.data(), padding.size());
+
+		const size_t nSamples = dataset.stride * dataset.height * dataset.nLights;
+		out.write(reinterpret_cast<const char*>(dataset.data()), nSamples * sizeof(Sample));
+
+		if (!out) {
+			out.close();
+			remove(partial, error);
+			throw invalid_argument{ "Cannot write file: " + partial.string() };
+		}
+	}
+
+	rename(partial, file, error);
+	if (error) {
+		remove(partial, error);
+		throw invalid_argument{ "Cannot write file: " + file.string() };
+	}
+	traceFileBytes("bytes written", file.string());
+}
+
+
+template optional<LightStack<uint8_t>> loadCachedDataset(const string&, const string&, const string&);
+template optional<LightStack<uint16_t>> loadCachedDataset(const string&, const string&, const string&);
+template optional<LightStack<Half>> loadCachedDataset(const string&, const string&, const string&);
+template optional<LightStack<float>> loadCachedDataset(const string&, const string&, const string&);
+
+template void storeCachedDataset(const LightStack<uint8_t>&, const string&, const string&, const string&);
+template void storeCachedDataset(const LightStack<uint16_t>&, const string&, const string&, const string&);
+template void storeCachedDataset(const LightStack<Half>&, const string&, const string&, const string&);
+template void storeCachedDataset(const LightStack<float>&, const string&, const string&, const string&);
\ No newline at end of file
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "LightStack.hpp"
+#include "Sample.hpp"
+
+#include <string>
+#include <optional>
+
+
+// A dataset can be cached as one binary file with its gray samples in
+// the layout of the LightStack and the light-directions, so later runs
+// map the file instead of decoding all images again. The cache of a
+// dataset is only used while the images are exactly the ones it was
+// made from: same names, sizes and modification times.
+
+
+// Describes the images of the dataset as they are right now.
+std::string datasetSignature(const std::string& datasetDirectory);
+
+
+// The dataset as a view of the mapped cache-file in cacheDirectory,
+// nothing if there is none or it was made from other images.
+template<typename Sample>
+std::optional<LightStack<Sample>> loadCachedDataset(
+	const std::string& cacheDirectory,
+	const std::string& datasetDirectory,
+	const std::string& signature);
+
+
+// Writes the cache-file for the dataset. The signature has to be taken
+// before the images are read, so a change while reading doesn't go
+// unnoticed.
+template<typename Sample>
+void storeCachedDataset(
+	const LightStack<Sample>& dataset,
+	const std::string& cacheDirectory,
+	const std::string& datasetDirectory,
+	const std::string& signature);
\ No newline at end of file
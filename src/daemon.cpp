@@ -0,0 +1,325 @@
+#include "daemon.hpp"
+#include "io.hpp"
+#include "util.hpp"
+#include "trace.hpp"
+using std::string;
+using std::vector;
+using std::size_t;
+using std::uint8_t;
+using std::uint16_t;
+
+#include <iostream>
+using std::cout;
+using std::cerr;
+
+#include <sstream>
+using std::ostringstream;
+
+#include <stdexcept>
+using std::invalid_argument;
+using std::exception;
+
+#include <functional>
+using std::function;
+
+#include <cstring>
+
+#include <thread>
+#include <chrono>
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <winsock2.h>
+#include <afunix.h>
+// For the Visual Studio project, CMake links it as well.
+#pragma comment(lib, "ws2_32.lib")
+using Socket = SOCKET;
+const Socket NO_SOCKET = INVALID_SOCKET;
+#else
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <cerrno>
+using Socket = int;
+const Socket NO_SOCKET = -1;
+#endif
+
+// A client that hung up must not end the daemon with SIGPIPE. Where
+// send has no flag for it, the socket of the client is set up so, see
+// acceptClient.
+#if defined(MSG_NOSIGNAL)
+const int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+const int SEND_FLAGS = 0;
+#endif
+
+// A request line longer than this is not a job, the client is hung up on.
+const size_t MAX_REQUEST_LENGTH = 64 * 1024;
+
+// Clients are served one at a time, so one that neither sends nor hangs
+// up is hung up on after this long, not to block the others.
+const int RECEIVE_TIMEOUT_SECONDS = 60;
+
+
+void closeSocket(const Socket s) {
+#if defined(_WIN32)
+	closesocket(s);
+#else
+	close(s);
+#endif
+}
+
+
+void removeSocketFile(const string& socketPath) {
+#if defined(_WIN32)
+	DeleteFileA(socketPath.c_str());
+#else
+	unlink(socketPath.c_str());
+#endif
+}
+
+
+// Removes the socket a daemon left behind when it was killed. Anything
+// else at the path is kept, it may be a file passed by mistake, and a
+// socket that takes connections belongs to a daemon that still runs.
+void removeStaleSocket(const string& socketPath, const sockaddr_un& address) {
+#if defined(_WIN32)
+	const DWORD attributes = GetFileAttributesA(socketPath.c_str());
+	if (attributes == INVALID_FILE_ATTRIBUTES) return;
+	if (!(attributes & FILE_ATTRIBUTE_REPARSE_POINT)) {
+		throw invalid_argument{ "Not a socket, refusing to replace: " + socketPath };
+	}
+#else
+	struct stat status;
+	if (lstat(socketPath.c_str(), &status) != 0) return;
+	if (!S_ISSOCK(status.st_mode)) {
+		throw invalid_argument{ "Not a socket, refusing to replace: " + socketPath };
+	}
+#endif
+
+	const Socket probe = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (probe == NO_SOCKET) throw invalid_argument{ "Cannot create socket: " + socketPath };
+	const bool live = connect(probe, reinterpret_cast<const sockaddr*>(&address), sizeof address) == 0;
+	closeSocket(probe);
+	if (live) throw invalid_argument{ "A daemon already listens on: " + socketPath };
+
+	removeSocketFile(socketPath);
+}
+
+
+Socket listenOn(const string& socketPath) {
+	sockaddr_un address{};
+	address.sun_family = AF_UNIX;
+	if (socketPath.size() >= sizeof address.sun_path) {
+		throw invalid_argument{ "Path of the socket too long: " + socketPath };
+	}
+	std::memcpy(address.sun_path, socketPath.c_str(), socketPath.size() + 1);
+
+	removeStaleSocket(socketPath, address);
+
+	const Socket s = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (s == NO_SOCKET) throw invalid_argument{ "Cannot create socket: " + socketPath };
+
+	if (bind(s, reinterpret_cast<const sockaddr*>(&address), sizeof address) != 0 || listen(s, 4) != 0) {
+		closeSocket(s);
+		throw invalid_argument{ "Cannot listen on socket: " + socketPath };
+	}
+	return s;
+}
+
+
+// Waits for the next client, NO_SOCKET if accepting it failed for a
+// reason of its own, e.g. it hung up before, which doesn't end the daemon.
+Socket acceptClient(const Socket listener) {
+	const Socket client = accept(listener, nullptr, nullptr);
+	if (client == NO_SOCKET) {
+#if defined(_WIN32)
+		const int error = WSAGetLastError();
+		if (error == WSAEINTR || error == WSAECONNRESET) return NO_SOCKET;
+#else
+		const int error = errno;
+		if (error == EINTR || error == ECONNABORTED) return NO_SOCKET;
+#endif
+		// E.g. out of file descriptors, which may pass, so the daemon
+		// keeps going but doesn't spin while it lasts.
+		cerr << "Cannot accept a client, error " << error << '\n';
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		return NO_SOCKET;
+	}
+
+#if defined(_WIN32)
+	const DWORD timeout = RECEIVE_TIMEOUT_SECONDS * 1000;
+#else
+	timeval timeout{};
+	timeout.tv_sec = RECEIVE_TIMEOUT_SECONDS;
+#endif
+	setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&timeout), sizeof timeout);
+#if defined(SO_NOSIGPIPE)
+	const int on = 1;
+	setsockopt(client, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof on);
+#endif
+	return client;
+}
+
+
+// False if the client is gone.
+bool sendLine(const Socket client, const string& line) {
+	const string data = line + '\n';
+	size_t sent = 0;
+	while (sent < data.size()) {
+		const int n = send(client, data.c_str() + sent, static_cast<int>(data.size() - sent), SEND_FLAGS);
+		if (n <= 0) return false;
+		sent += n;
+	}
+	return true;
+}
+
+
+// The job of a request line and the options of its normal-map,
+// fields starting with "--" after the ones of the manifest.
+BatchJob parseRequest(const string& line, OutputFormat& output) {
+	const size_t optionsBegin = line.find(";--");
+	const BatchJob job = parseJob(line.substr(0, optionsBegin));
+
+	if (optionsBegin != string::npos) {
+		for (const string& field : splitBy(line.substr(optionsBegin + 1), ';')) {
+			const size_t equals = field.find('=');
+			const string option = field.substr(0, equals);
+			const string value = equals == string::npos ? "" : field.substr(equals + 1);
+
+			if (option == "--depth") {
+				output.sampleFormat = parseSampleFormat(value);
+			}
+			else if (option == "--layout") {
+				output.layout = parseLayout(value);
+			}
+			else {
+				throw invalid_argument{ "Unknown option: " + option };
+			}
+		}
+	}
+	return job;
+}
+
+
+// Answers the requests of one client until it hangs up, stays silent
+// for too long or sends a line that is too long.
+// Returns true if it asked to quit.
+template<typename Sample>
+bool serveClient(const Socket client, Session<Sample>& session, const RunOptions& options, const function<void()>& afterJob) {
+	string pending;
+	char buffer[4096];
+
+	while (true) {
+		const size_t newline = pending.find('\n');
+		if (newline == string::npos) {
+			if (pending.size() > MAX_REQUEST_LENGTH) {
+				cerr << "Request line too long, hanging up.\n";
+				sendLine(client, "error Request line too long.");
+				return false;
+			}
+			const int n = recv(client, buffer, sizeof buffer, 0);
+			if (n <= 0) return false;
+			pending.append(buffer, n);
+			continue;
+		}
+
+		string line = pending.substr(0, newline);
+		pending.erase(0, newline + 1);
+		if (!line.empty() && line.back() == '\r') line.pop_back();
+		if (line.empty()) continue;
+
+		if (line == "quit") {
+			sendLine(client, "bye");
+			return true;
+		}
+
+		string reply;
+		try {
+			OutputFormat output = options.output;
+			const BatchJob job = parseRequest(line, output);
+			cout << "Job: " << job.datasetDirectory << '\n';
+
+			// Each job is traced on its own, so the trace never grows
+			// with the uptime and shows no waiting for jobs.
+			if (tracingEnabled()) restartTracing();
+
+			const JobTimes times = session.run(job, output);
+			ostringstream out;
+			out << "ok solve=" << times.solve << " write=" << times.write << " total=" << times.total;
+			reply = out.str();
+		}
+		catch (const exception& e) {
+			// A job that fails never ends the daemon.
+			cerr << line << ": " << e.what() << '\n';
+			reply = string{ "error " } + e.what();
+		}
+		cout << reply << '\n';
+
+		if (afterJob) {
+			try {
+				afterJob();
+			}
+			catch (const exception& e) {
+				cerr << e.what() << '\n';
+			}
+		}
+
+		if (!sendLine(client, reply)) return false;
+	}
+}
+
+
+template<typename Sample>
+void serve(const Socket listener, const RunOptions& options, const function<void()>& afterJob) {
+	Session<Sample> session{ options };
+
+	while (true) {
+		const Socket client = acceptClient(listener);
+		if (client == NO_SOCKET) continue;
+
+		const bool quit = serveClient(client, session, options, afterJob);
+		closeSocket(client);
+		if (quit) return;
+	}
+}
+
+
+void runDaemon(const string& socketPath, const RunOptions& options, const function<void()>& afterJob) {
+	checkJobOptions(options, "daemon mode");
+
+#if defined(_WIN32)
+	WSADATA wsa;
+	if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) throw invalid_argument{ "Cannot start Winsock." };
+#endif
+
+	const Socket listener = listenOn(socketPath);
+	cout << "Waiting for jobs on " << socketPath << '\n';
+
+	try {
+		switch (options.sampleFormat) {
+		case SampleFormat::UInt8: serve<uint8_t>(listener, options, afterJob); break;
+		case SampleFormat::Half: serve<Half>(listener, options, afterJob); break;
+		case SampleFormat::Float: serve<float>(listener, options, afterJob); break;
+		default: serve<uint16_t>(listener, options, afterJob); break;
+		}
+	}
+	catch (...) {
+		closeSocket(listener);
+		removeSocketFile(socketPath);
+		throw;
+	}
+
+	closeSocket(listener);
+	removeSocketFile(socketPath);
+#if defined(_WIN32)
+	WSACleanup();
+#endif
+}
\ No newline at end of file
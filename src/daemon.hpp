@@ -0,0 +1,38 @@
+#pragma once
+
+#include "pipeline.hpp"
+
+#include <string>
+#include <functional>
+
+
+// Serves jobs on a local socket, so a scanning station pays for
+// starting the process, loading the OIIO plugins and creating the
+// thread-pool once and not for every scan, see Session.
+//
+// A client connects and sends one job per line, like a line of a
+// manifest (see readManifest), optionally followed by options of the
+// normal-map as further fields:
+//
+//     dataset;result;correction[;albedo[;height]][;--depth=u16][;--layout=tiles]
+//
+// Each job gets one line back when it is done, the seconds it took or
+// why it failed:
+//
+//     ok solve=0.412 write=0.105 total=0.517
+//     error Cannot open file: ...
+//
+// The line "quit" is answered with "bye" and ends the daemon. Jobs run
+// one after another, also those of different clients: a client is
+// served once the one before has hung up. So a client that sends nothing
+// for a minute is hung up on, and so is one whose line is longer than
+// 64 KiB, after the line "error Request line too long.".
+
+
+// Listens on a Unix domain socket at socketPath until a client sends
+// "quit". A socket left there by a daemon that was killed is replaced,
+// anything else at the path is an error. The options are those of a
+// batch, see checkJobOptions. Each job is traced on its own, from a
+// restart of the trace, and afterJob is called after every job, when no
+// thread works, e.g. to write the trace.
+void runDaemon(const std::string& socketPath, const RunOptions& options, const std::function<void()>& afterJob = nullptr);
\ No newline at end of file
@@ -0,0 +1,137 @@
+#include "frames.hpp"
+#include "TileScheduler.hpp"
+#include "util.hpp"
+#include "trace.hpp"
+using std::vector;
+using std::size_t;
+using std::uint8_t;
+using std::uint16_t;
+
+#include <stdexcept>
+using std::invalid_argument;
+
+#include <algorithm>
+using std::min;
+using std::max;
+
+using std::future;
+
+#include <thread>
+#include <cassert>
+
+
+// Rows of all frames converted by one task, like the chunks of files.
+const size_t FRAME_CHUNK_ROWS = DatasetReader<float>::CHUNK_ROWS;
+
+
+template<typename Sample>
+LightStack<Sample> makeDataset(const size_t width, const size_t height, const vector<Vec3>& lightDirections) {
+	if (lightDirections.size() < DatasetReader<Sample>::MIN_LIGHTS || DatasetReader<Sample>::MAX_LIGHTS < lightDirections.size()) {
+		throw invalid_argument{ "Expected " + std::to_string(DatasetReader<Sample>::MIN_LIGHTS) + " to "
+			+ std::to_string(DatasetReader<Sample>::MAX_LIGHTS) + " lamps, got " + std::to_string(lightDirections.size()) };
+	}
+
+	LightStack<Sample> dataset{ width, height, lightDirections.size() };
+	dataset.lightDirections = lightDirections;
+	return dataset;
+}
+
+
+template<typename Sample>
+FrameSolver<Sample>::FrameSolver(
+	const size_t width,
+	const size_t height,
+	const PixelFormat& format,
+	const vector<Vec3>& lightDirections,
+	const RunOptions& options,
+	const unsigned int nThreads)
+	:
+	width(width),
+	height(height),
+	format(format),
+	parallelism(nThreads > 0 ? nThreads : max(1u, std::thread::hardware_concurrency())),
+	pool(parallelism),
+	dataset(makeDataset<Sample>(width, height, lightDirections)),
+	solver(lightDirections, width, height, options.correctionRadians, options.precision, options.isa, options.rejection)
+{
+	if (format.nChannels != 1 && format.nChannels != 3 && format.nChannels != 4) {
+		throw invalid_argument{ "Frames need 1, 3 or 4 channels, not " + std::to_string(format.nChannels) };
+	}
+}
+
+
+template<typename Sample>
+void FrameSolver<Sample>::solve(const vector<Frame>& frames, double* normals, double* albedo) {
+	if (frames.size() != dataset.nLights) {
+		throw invalid_argument{ "Expected one frame per lamp, " + std::to_string(dataset.nLights) + " of them." };
+	}
+
+	const size_t packedStride = width * format.bytesPerPixel();
+	TileScheduler scheduler{ width, height, false };
+
+	// Chunks of rows of all frames, so the tiles of a chunk can be
+	// solved as soon as it is done, while the next are converted.
+	vector<future<void>> converters;
+	for (size_t begin = 0; begin < height; begin += FRAME_CHUNK_ROWS) {
+		const size_t end = min(height, begin + FRAME_CHUNK_ROWS);
+		converters.push_back(pool.enqueue([this, &frames, &scheduler, packedStride, begin, end] {
+			try {
+				const TraceSpan span{ "gray" };
+				vector<Sample> row(width);
+				for (size_t k = 0; k < frames.size(); ++k) {
+					const size_t stride = frames[k].rowStride == 0 ? packedStride : frames[k].rowStride;
+					const unsigned char* pixels = static_cast<const unsigned char*>(frames[k].pixels);
+					for (size_t y = begin; y < end; ++y) {
+						pixelsToGray(pixels + y * stride, format, width, &row[0]);
+						dataset.setRow(k, y, &row[0]);
+					}
+				}
+			}
+			catch (...) {
+				// The rows will never come.
+				scheduler.cancel();
+				throw;
+			}
+			scheduler.publishRows(begin, end);
+		}));
+	}
+
+	// Enqueued after the converters, so a worker waiting for rows
+	// never holds up a converter that is still in the queue.
+	vector<future<void>> workers;
+	for (unsigned int i = 0; i + 1 < parallelism; ++i) {
+		workers.push_back(pool.enqueue([this, &scheduler, normals, albedo] {
+			solver.work(dataset, scheduler, normals, albedo);
+		}));
+	}
+
+	try {
+		// The calling thread is one of the workers.
+		solver.work(dataset, scheduler, normals, albedo);
+		waitAll(converters);
+	}
+	catch (...) {
+		// The rows may never come, but the tasks still
+		// use the scheduler, the frames and the dataset.
+		scheduler.cancel();
+		waitFor(converters);
+		waitFor(workers);
+		throw;
+	}
+
+	waitAll(workers);
+}
+
+
+template<typename Sample>
+NormalMap FrameSolver<Sample>::solve(const vector<Frame>& frames) {
+	vector<double> normalsData(width * height * 3);
+	solve(frames, &normalsData[0]);
+	return NormalMap{ width, height, std::move(normalsData) };
+}
+
+
+template class FrameSolver<uint8_t>;
+template class FrameSolver<uint16_t>;
+template class FrameSolver<Half>;
+template class FrameSolver<float>;
\ No newline at end of file
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "solve.hpp"
+#include "io.hpp"
+#include "pipeline.hpp"
+#include "LightStack.hpp"
+#include "NormalMap.hpp"
+#include "Vec.hpp"
+
+#include <vector>
+
+
+// Solves datasets whose images are already in memory, e.g. frames a
+// capture program just took, without files in between. The frames
+// belong to the caller and are only read, the normals are written
+// straight into the caller's memory.
+
+
+// One image of a dataset, with one lamp on.
+struct Frame {
+	const void* pixels;
+
+	// Bytes from the start of one row to the next,
+	// 0 if the rows follow each other without gaps.
+	std::size_t rowStride = 0;
+};
+
+
+// Solves frames of the same size and format, taken under the same
+// lamps, over and over. Keeps a thread-pool, the solver and the memory
+// of the samples for the next frames. Of the options only the
+// correction, the precision, the instruction set and the rejection
+// are used. Solves on nThreads threads, the calling one included, or
+// on one per core if it is 0.
+template<typename Sample>
+class FrameSolver {
+public:
+	const std::size_t width;
+	const std::size_t height;
+	const PixelFormat format;
+
+	// The directions to the lamps, see incidentIlluminationDirection.
+	FrameSolver(
+		const std::size_t width,
+		const std::size_t height,
+		const PixelFormat& format,
+		const std::vector<Vec3>& lightDirections,
+		const RunOptions& options = {},
+		const unsigned int nThreads = 0);
+
+	FrameSolver(const FrameSolver&) = delete;
+	FrameSolver& operator=(const FrameSolver&) = delete;
+
+
+	// Writes the normals of the frames, one per lamp in the order of the
+	// directions, as (x, y, z) one after another into normals, which
+	// has to hold width * height * 3 values. The albedo is written
+	// likewise, one value per pixel, unless it is null. Converting the
+	// frames and solving overlap.
+	void solve(const std::vector<Frame>& frames, double* normals, double* albedo = nullptr);
+
+	// Like above, into a normal-map of its own.
+	NormalMap solve(const std::vector<Frame>& frames);
+
+private:
+	const unsigned int parallelism;
+	ThreadPool pool;
+	LightStack<Sample> dataset;
+	const Solver<Sample> solver;
+};
\ No newline at end of file
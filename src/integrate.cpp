@@ -0,0 +1,304 @@
+#include "integrate.hpp"
+#include "TileScheduler.hpp"
+#include "trace.hpp"
+using std::vector;
+using std::size_t;
+using std::function;
+
+#include <algorithm>
+using std::max;
+using std::min;
+
+#include <cmath>
+using std::sqrt;
+
+#include <mutex>
+using std::mutex;
+using std::lock_guard;
+
+#include <memory>
+using std::unique_ptr;
+using std::make_unique;
+
+
+// Normals steeper than this are clamped, so silhouettes
+// don't turn into huge slopes.
+const double MIN_NORMAL_Z = 0.1;
+
+// Grids smaller than this are not worth the threads.
+const size_t PARALLEL_MIN_PIXELS = 1 << 16;
+
+// Coarsening stops at grids this small in both directions. Both
+// directions are halved together, one that reached 1 stays 1, so a
+// narrow strip still ends up tiny and the cells stay square.
+const size_t COARSEST_SIZE = 4;
+
+const int PRE_SMOOTHING = 2;
+const int POST_SMOOTHING = 2;
+const int MAX_CYCLES = 30;
+
+// Residual relative to the right-hand side to stop at.
+const double TOLERANCE = 1e-6;
+
+
+// A grid of the multigrid hierarchy. The equation on every grid is
+// degree(i) * h(i) - (sum of the neighbours of i) = b(i), i.e. the
+// graph-Laplacian of the grid, which has the Neumann boundaries built in.
+// The heights are much larger than the residuals, so they need doubles
+// or the residuals drown in rounding.
+struct Level {
+	const size_t width;
+	const size_t height;
+
+	vector<double> h;
+	vector<float> b;
+	vector<float> r;
+
+	Level(const size_t width, const size_t height)
+		:
+		width(width), height(height), h(width * height, 0.0), b(width * height, 0.0f), r(width * height, 0.0f)
+	{}
+};
+
+
+// Runs fn on all tiles of the level, on the pool if it is worth it.
+void forEachTile(const Level& level, ThreadPool& pool, const unsigned int nWorkers, const function<void(const Tile&)>& fn) {
+	TileScheduler scheduler{ level.width, level.height };
+	if (level.width * level.height < PARALLEL_MIN_PIXELS) {
+		scheduler.work(fn);
+	}
+	else {
+		scheduler.run(pool, nWorkers, fn);
+	}
+}
+
+
+// Degree and sum of the neighbours of (x, y).
+inline double laplaceTerms(const Level& l, const size_t x, const size_t y, double& degree) {
+	const double* h = &l.h[y * l.width + x];
+	double sum = 0.0;
+	degree = 0.0;
+	if (x > 0) { sum += h[-1]; degree += 1.0; }
+	if (x + 1 < l.width) { sum += h[1]; degree += 1.0; }
+	if (y > 0) { sum += h[-static_cast<std::ptrdiff_t>(l.width)]; degree += 1.0; }
+	if (y + 1 < l.height) { sum += h[l.width]; degree += 1.0; }
+	return sum;
+}
+
+
+// Calls fn(i, degree, sum of the neighbours) for every step-th cell of
+// row y in [xBegin, xEnd). Only the cells at the border need the checks.
+template<typename Fn>
+inline void forCells(const Level& l, const size_t y, const size_t xBegin, const size_t xEnd, const size_t step, const Fn& fn) {
+	const size_t w = l.width;
+	const bool inner = y > 0 && y + 1 < l.height;
+	const double* h = &l.h[0];
+
+	for (size_t x = xBegin; x < xEnd; x += step) {
+		const size_t i = y * w + x;
+		if (inner && x > 0 && x + 1 < w) {
+			fn(i, 4.0, h[i - 1] + h[i + 1] + h[i - w] + h[i + w]);
+		}
+		else {
+			double degree;
+			const double sum = laplaceTerms(l, x, y, degree);
+			fn(i, degree, sum);
+		}
+	}
+}
+
+
+// One red-black Gauss-Seidel sweep. All cells of one color only
+// depend on cells of the other one, so the tiles are independent.
+void relax(Level& l, ThreadPool& pool, const unsigned int nWorkers) {
+	for (size_t color = 0; color < 2; ++color) {
+		forEachTile(l, pool, nWorkers, [&l, color](const Tile& t) {
+			for (size_t y = t.yBegin; y < t.yEnd; ++y) {
+				const size_t first = t.xBegin + ((t.xBegin + y + color) & 1);
+				forCells(l, y, first, t.xEnd, 2, [&l](const size_t i, const double degree, const double sum) {
+					if (degree > 0.0) {
+						l.h[i] = (l.b[i] + sum) / degree;
+					}
+				});
+			}
+		});
+	}
+}
+
+
+// r = b - A * h, returns the squared norm of r.
+double residual(Level& l, ThreadPool& pool, const unsigned int nWorkers) {
+	mutex sumMutex;
+	double sum = 0.0;
+
+	forEachTile(l, pool, nWorkers, [&l, &sumMutex, &sum](const Tile& t) {
+		double tileSum = 0.0;
+		for (size_t y = t.yBegin; y < t.yEnd; ++y) {
+			forCells(l, y, t.xBegin, t.xEnd, 1, [&l, &tileSum](const size_t i, const double degree, const double neighbours) {
+				l.r[i] = static_cast<float>(l.b[i] - (degree * l.h[i] - neighbours));
+				tileSum += static_cast<double>(l.r[i]) * l.r[i];
+			});
+		}
+		const lock_guard<mutex> lock{ sumMutex };
+		sum += tileSum;
+	});
+
+	return sum;
+}
+
+
+// The residual of the fine grid becomes the right-hand side of the
+// coarse one. The coarse grid has twice the spacing, so its Laplacian
+// is 4 times weaker, hence 4 times the average of the children. The
+// last cell of an odd size has only half the children and gets only
+// their share, not their average, or it pulls the whole grid.
+void restrictResidual(const Level& fine, Level& coarse, ThreadPool& pool, const unsigned int nWorkers) {
+	// Children of a whole cell, a direction of size 1 has only one.
+	const float children = static_cast<float>((fine.width > 1 ? 2 : 1) * (fine.height > 1 ? 2 : 1));
+
+	forEachTile(coarse, pool, nWorkers, [&fine, &coarse, children](const Tile& t) {
+		for (size_t y = t.yBegin; y < t.yEnd; ++y) {
+			for (size_t x = t.xBegin; x < t.xEnd; ++x) {
+				float sum = 0.0f;
+				for (size_t fy = 2 * y; fy < min(2 * y + 2, fine.height); ++fy) {
+					for (size_t fx = 2 * x; fx < min(2 * x + 2, fine.width); ++fx) {
+						sum += fine.r[fy * fine.width + fx];
+					}
+				}
+				coarse.b[y * coarse.width + x] = 4.0f * sum / children;
+				coarse.h[y * coarse.width + x] = 0.0;
+			}
+		}
+	});
+
+	// With Neumann boundaries there is only a solution if the
+	// right-hand side sums up to zero, rounding aside.
+	double sum = 0.0;
+	for (const float value : coarse.b) sum += value;
+	const float mean = static_cast<float>(sum / coarse.b.size());
+	for (float& value : coarse.b) value -= mean;
+}
+
+
+// Adds the bilinear interpolation of the coarse correction. The center
+// of fine cell x lies a quarter coarse cell off the center of x / 2.
+void prolongAndCorrect(const Level& coarse, Level& fine, ThreadPool& pool, const unsigned int nWorkers) {
+	forEachTile(fine, pool, nWorkers, [&fine, &coarse](const Tile& t) {
+		for (size_t y = t.yBegin; y < t.yEnd; ++y) {
+			const size_t cy = y / 2;
+			const size_t ny = y % 2 == 0 ? (cy > 0 ? cy - 1 : cy) : min(cy + 1, coarse.height - 1);
+
+			for (size_t x = t.xBegin; x < t.xEnd; ++x) {
+				const size_t cx = x / 2;
+				const size_t nx = x % 2 == 0 ? (cx > 0 ? cx - 1 : cx) : min(cx + 1, coarse.width - 1);
+
+				const double* c = &coarse.h[0];
+				const double value =
+					0.5625 * c[cy * coarse.width + cx] +
+					0.1875 * c[cy * coarse.width + nx] +
+					0.1875 * c[ny * coarse.width + cx] +
+					0.0625 * c[ny * coarse.width + nx];
+				fine.h[y * fine.width + x] += value;
+			}
+		}
+	});
+}
+
+
+void vCycle(vector<unique_ptr<Level>>& levels, const size_t depth, ThreadPool& pool, const unsigned int nWorkers) {
+	Level& l = *levels[depth];
+
+	if (depth + 1 == levels.size()) {
+		// Tiny, so just smooth until it is solved.
+		const size_t sweeps = max<size_t>(50, 4 * l.width * l.height);
+		for (size_t i = 0; i < sweeps; ++i) {
+			relax(l, pool, nWorkers);
+		}
+		return;
+	}
+
+	for (int i = 0; i < PRE_SMOOTHING; ++i) {
+		relax(l, pool, nWorkers);
+	}
+
+	residual(l, pool, nWorkers);
+	restrictResidual(l, *levels[depth + 1], pool, nWorkers);
+	vCycle(levels, depth + 1, pool, nWorkers);
+	prolongAndCorrect(*levels[depth + 1], l, pool, nWorkers);
+
+	for (int i = 0; i < POST_SMOOTHING; ++i) {
+		relax(l, pool, nWorkers);
+	}
+}
+
+
+HeightMap integrateNormals(const NormalMapView& normalMap, ThreadPool& pool, const unsigned int nWorkers) {
+	const TraceSpan span{ "integrate" };
+
+	const size_t width = normalMap.width;
+	const size_t height = normalMap.height;
+
+	vector<unique_ptr<Level>> levels;
+	levels.push_back(make_unique<Level>(width, height));
+	while (levels.back()->width > COARSEST_SIZE || levels.back()->height > COARSEST_SIZE) {
+		const Level& l = *levels.back();
+		levels.push_back(make_unique<Level>((l.width + 1) / 2, (l.height + 1) / 2));
+	}
+
+	Level& top = *levels[0];
+	const double* normals = normalMap.normalsData;
+
+	// The slopes of pixel i along the rows and from row to row.
+	const auto slopes = [normals](const size_t i, float& p, float& q) {
+		const double* n = normals + i * 3;
+		const double z = max(n[2], MIN_NORMAL_Z);
+		p = static_cast<float>(-n[0] / z);
+		q = static_cast<float>(-n[1] / z);
+	};
+
+	// Every pair of neighbours should differ by the average of their
+	// slopes, which gives b(i) = (slope into i) - (slope out of i).
+	forEachTile(top, pool, nWorkers, [&top, &slopes](const Tile& t) {
+		for (size_t y = t.yBegin; y < t.yEnd; ++y) {
+			for (size_t x = t.xBegin; x < t.xEnd; ++x) {
+				const size_t i = y * top.width + x;
+				float p, q;
+				slopes(i, p, q);
+
+				float b = 0.0f;
+				float pn, qn;
+				if (x > 0) { slopes(i - 1, pn, qn); b += (p + pn) / 2; }
+				if (x + 1 < top.width) { slopes(i + 1, pn, qn); b -= (p + pn) / 2; }
+				if (y > 0) { slopes(i - top.width, pn, qn); b += (q + qn) / 2; }
+				if (y + 1 < top.height) { slopes(i + top.width, pn, qn); b -= (q + qn) / 2; }
+				top.b[i] = b;
+			}
+		}
+	});
+
+	double bNorm = 0.0;
+	for (const float value : top.b) bNorm += static_cast<double>(value) * value;
+
+	// Rounding keeps the residual from getting arbitrarily small, so it
+	// also stops when a cycle doesn't halve it anymore.
+	double rNorm = bNorm;
+	for (int cycle = 0; cycle < MAX_CYCLES && bNorm > 0.0; ++cycle) {
+		vCycle(levels, 0, pool, nWorkers);
+		const double previous = rNorm;
+		rNorm = residual(top, pool, nWorkers);
+		if (rNorm <= TOLERANCE * TOLERANCE * bNorm || rNorm * 4.0 > previous) {
+			break;
+		}
+	}
+
+	// Only the differences are known, so the mean is made zero.
+	double sum = 0.0;
+	for (const double value : top.h) sum += value;
+	const double mean = sum / top.h.size();
+
+	vector<float> heightData(top.h.size());
+	for (size_t i = 0; i < heightData.size(); ++i) {
+		heightData[i] = static_cast<float>(top.h[i] - mean);
+	}
+	return HeightMap{ width, height, std::move(heightData) };
+}
\ No newline at end of file
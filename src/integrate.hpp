@@ -0,0 +1,15 @@
+#pragma once
+
+#include "NormalMap.hpp"
+#include "HeightMap.hpp"
+
+#include "../submodules/ThreadPool/ThreadPool.h"
+
+
+// Integrates the normals into heights. The normals give the slopes
+// p = -x / z along the rows and q = -y / z from row to row, and the
+// heights that fit them best (least squares) solve the Poisson
+// equation laplace(h) = dp/dx + dq/dy with Neumann boundaries. That
+// is solved with multigrid V-cycles, each step in parallel on nWorkers
+// tasks of the pool and the calling thread.
+HeightMap integrateNormals(const NormalMapView& normalMap, ThreadPool& pool, const unsigned int nWorkers);
\ No newline at end of file
@@ -5,16 +5,18 @@ using std::stod;
 
 #include "NormalMap.hpp"
 #include "util.hpp"
+#include "trace.hpp"
 
 #include <stdexcept>
 using std::invalid_argument;
 
-#include <OpenImageIO/imageio.h>
-
 #include <iostream>
 using std::cout;
 
 using std::size_t;
+using std::uint8_t;
+using std::uint16_t;
+using std::uint32_t;
 
 #include <cassert>
 
@@ -24,9 +26,36 @@ using std::filesystem::directory_iterator;
 using std::filesystem::is_directory;
 
 #include <algorithm>
+using std::min;
+using std::max;
+using std::minmax_element;
+using std::transform;
+using std::sort;
+using std::find;
+using std::all_of;
+
+#include <cctype>
+using std::tolower;
+
+#include <limits>
+#include <type_traits>
+#include <cmath>
+
+#include <utility>
+using std::pair;
+
+#include <atomic>
+using std::atomic;
+
+using std::future;
+
+#include <memory>
+using std::make_shared;
 
 
 vector<string> listItems(const string& dir) {
+	const TraceSpan span{ "list" };
+
 	const path p{ dir };
 	vector<string> items;
 	if (is_directory(p)) {
@@ -41,38 +70,37 @@ vector<string> listItems(const string& dir) {
 }
 
 
-vector<ReflectionMap> readDataset(const string& dir) {
-
-	const vector<string> items = listItems(dir);
+SampleFormat parseSampleFormat(const string& s) {
+	if (s == "u8") return SampleFormat::UInt8;
+	if (s == "u16") return SampleFormat::UInt16;
+	if (s == "f16") return SampleFormat::Half;
+	if (s == "f32") return SampleFormat::Float;
+	throw invalid_argument{ "Unknown sample format: " + s };
+}
 
-	if (items.size() != 8) {
-		throw invalid_argument{ "Currently only for 8 images." };
-	}
 
-	vector<ReflectionMap> dataset;
-	dataset.reserve(8);
-	
-	for (auto & item : items) {
-		dataset.push_back(readIntensities(item));
-	}
+Layout parseLayout(const string& s) {
+	if (s == "scanlines") return Layout::Scanlines;
+	if (s == "tiles") return Layout::Tiles;
+	if (s == "mipmap") return Layout::MipMap;
+	throw invalid_argument{ "Unknown layout: " + s };
+}
 
-	for (int i = 1; i < dataset.size(); ++i) {
-		if ((dataset[0].width != dataset[i].width) || (dataset[0].height != dataset[i].height)) {
-			throw invalid_argument("The files are not the same size!");
-		}
-	}
 
-	return dataset;
+bool storesFloats(const string& file) {
+	string extension = path{ file }.extension().string();
+	transform(extension.begin(), extension.end(), extension.begin(), [](const unsigned char c) { return static_cast<char>(tolower(c)); });
+	return extension == ".exr" || extension == ".tif" || extension == ".tiff" || extension == ".hdr" || extension == ".pfm";
 }
 
 
-ReflectionMap readIntensities(const string & file) {
-	cout << "Reading image.\n";
-
+// Parses the lamp's direction out of a file name like
+// "name_azimuthalAngle_polarAngle.ext", angles in radians.
+pair<double, double> parseLampAngles(const string& file) {
 	vector<string> imageParams = splitBy(path{ file }.stem().string(), '_');
 
-	if (imageParams.size() != 3) {
-		throw invalid_argument("File expected in the form \"name_azimuthalAngle_polarAngle.ext\": " + file);
+	if (imageParams.size() != 3 && imageParams.size() != 4) {
+		throw invalid_argument("File expected in the form \"name_azimuthalAngle_polarAngle[_exposure].ext\": " + file);
 	}
 
 	const double azimuthalDegrees = stod(imageParams[1]);
@@ -85,95 +113,937 @@ ReflectionMap readIntensities(const string & file) {
 		throw invalid_argument("Illegal polar-angle: " + file);
 	}
 
-	const OIIO::ImageInput::unique_ptr in = OIIO::ImageInput::open(file);
+	return { degreesToRadians(azimuthalDegrees), degreesToRadians(polarDegress) };
+}
+
+
+double parseExposure(const string& file) {
+	const vector<string> imageParams = splitBy(path{ file }.stem().string(), '_');
+	if (imageParams.size() != 4) return 1.0;
+
+	const double exposure = stod(imageParams[3]);
+	if (!(exposure > 0.0) || std::isinf(exposure)) {
+		throw invalid_argument("Illegal exposure: " + file);
+	}
+	return exposure;
+}
+
+
+// Opens the image and checks that we can handle its format.
+OIIO::ImageInput::unique_ptr openImage(const string& file) {
+	OIIO::ImageInput::unique_ptr in = OIIO::ImageInput::open(file);
 	if (!in) throw invalid_argument{ "Cannot open file: " + file };
 
-	const OIIO::ImageSpec& inSpec{ in->spec() };
-	const int numChannels = inSpec.nchannels;
-	if (numChannels == 3) {
-		for (int i = 0; i < numChannels; ++i) {
-			if (!(inSpec.channelformat(i) == OIIO::TypeDesc::UINT8)) {
-				in->close();
-				throw invalid_argument("Only accepting 8-bit-formats currently: " + file);
+	// Gray, gray with alpha, RGB or RGBA.
+	const int numChannels = in->spec().nchannels;
+	if (numChannels < 1 || 4 < numChannels) {
+		in->close();
+		throw invalid_argument("Only accepting gray- and RGB-formats: " + file);
+	}
+
+	return in;
+}
+
+
+// Values of pixels as floats, for the converters below.
+template<typename In>
+float asFloat(const In v) { return static_cast<float>(v); }
+inline float asFloat(const Half v) { return toFloat(v); }
+
+
+// Converts pixels with N channels into samples per channel. N is known
+// at compile time, like for toGray, and gray goes into all three.
+template<size_t N, typename In, typename Sample>
+void toChannels(const In* pixels, const size_t nPixels, Sample* red, Sample* green, Sample* blue) {
+	static_assert(N == 1 || N == 3 || N == 4);
+	constexpr size_t greenOffset = N == 1 ? 0 : 1;
+	constexpr size_t blueOffset = N == 1 ? 0 : 2;
+
+	const auto toSample = [](const In v) {
+		if constexpr (std::is_same_v<In, Sample> && std::is_integral_v<Sample>) {
+			return v;
+		}
+		else if constexpr (std::is_integral_v<In> && std::is_integral_v<Sample>) {
+			// Fixed point as in toGray, exact where the largest sample
+			// is a multiple of the largest value, like 65535 of 255.
+			constexpr double inMax = std::numeric_limits<In>::max();
+			constexpr double sampleMax = std::numeric_limits<Sample>::max();
+			constexpr uint32_t one = static_cast<uint32_t>(sampleMax / inMax * 65536 + 0.5);
+			return static_cast<Sample>((one * v + (1u << 15)) >> 16);
+		}
+		else if constexpr (std::is_integral_v<In>) {
+			return SampleTraits<Sample>::fromUnit(asFloat(v) / static_cast<float>(std::numeric_limits<In>::max()));
+		}
+		else {
+			// Floats may be outside of [0, 1].
+			const float value = min(1.0f, max(0.0f, asFloat(v)));
+			if constexpr (std::is_integral_v<Sample>) {
+				return static_cast<Sample>(value * std::numeric_limits<Sample>::max() + 0.5f);
+			}
+			else {
+				return SampleTraits<Sample>::fromUnit(value);
+			}
+		}
+	};
+
+	for (size_t i = 0; i < nPixels; ++i) {
+		const In* p = pixels + i * N;
+		red[i] = toSample(p[0]);
+		green[i] = toSample(p[greenOffset]);
+		blue[i] = toSample(p[blueOffset]);
+	}
+}
+
+
+template<typename Sample>
+void splitChannels(const unsigned char* rgb, const size_t nPixels, Sample* red, Sample* green, Sample* blue) {
+	toChannels<3>(rgb, nPixels, red, green, blue);
+}
+
+
+// Weights of R, G and B for gray.
+constexpr double RED_WEIGHT = 0.299;
+constexpr double GREEN_WEIGHT = 0.587;
+
+
+// Converts pixels with N channels into gray. N is known at compile time,
+// so there is no branch per pixel and compilers vectorize the loop for
+// every type of pixels and samples.
+template<size_t N, typename In, typename Sample>
+void toGray(const In* pixels, const size_t nPixels, Sample* gray) {
+	static_assert(N == 1 || N == 3 || N == 4);
+
+	// Gray is taken as it is, alpha is ignored.
+	constexpr double redWeight = N == 1 ? 1.0 : RED_WEIGHT;
+	constexpr double greenWeight = N == 1 ? 0.0 : GREEN_WEIGHT;
+	constexpr double blueWeight = 1.0 - redWeight - greenWeight;
+
+	if constexpr (N == 1 && std::is_same_v<In, Sample> && std::is_integral_v<Sample>) {
+		std::copy(pixels, pixels + nPixels, gray);
+	}
+	else if constexpr (std::is_integral_v<In> && std::is_integral_v<Sample>) {
+		// Fixed-point weights, scaled so they sum up to exactly the largest
+		// sample times 2^16, so white stays white. Only integer multiplies,
+		// adds and a shift per pixel. The sum of a pixel stays below 2^32.
+		constexpr double inMax = std::numeric_limits<In>::max();
+		constexpr double sampleMax = std::numeric_limits<Sample>::max();
+		constexpr uint32_t one = static_cast<uint32_t>(sampleMax / inMax * 65536 + 0.5);
+		constexpr uint32_t red = static_cast<uint32_t>(redWeight * one + 0.5);
+		constexpr uint32_t green = static_cast<uint32_t>(greenWeight * one + 0.5);
+		constexpr uint32_t blue = one - red - green;
+
+		for (size_t i = 0; i < nPixels; ++i) {
+			const In* p = pixels + i * N;
+			uint32_t value = red * p[0];
+			if constexpr (N > 1) {
+				value += green * p[1] + blue * p[2];
 			}
+			gray[i] = static_cast<Sample>((value + (1u << 15)) >> 16);
 		}
 	}
 	else {
-		in->close();
-		throw invalid_argument("Only accepting RGB-formats (not RGBA) currently: " + file);
+		// Integers are scaled into [0, 1] by the weights, floats may be
+		// outside and are clamped.
+		constexpr double scale = [] {
+			if constexpr (std::is_integral_v<In>) return 1.0 / std::numeric_limits<In>::max();
+			else return 1.0;
+		}();
+		constexpr float red = static_cast<float>(redWeight * scale);
+		constexpr float green = static_cast<float>(greenWeight * scale);
+		constexpr float blue = static_cast<float>(blueWeight * scale);
+
+		for (size_t i = 0; i < nPixels; ++i) {
+			const In* p = pixels + i * N;
+			float value = red * asFloat(p[0]);
+			if constexpr (N > 1) {
+				value += green * asFloat(p[1]) + blue * asFloat(p[2]);
+			}
+			if constexpr (!std::is_integral_v<In>) {
+				value = min(1.0f, max(0.0f, value));
+			}
+
+			if constexpr (std::is_integral_v<Sample>) {
+				gray[i] = static_cast<Sample>(value * std::numeric_limits<Sample>::max() + 0.5f);
+			}
+			else {
+				gray[i] = SampleTraits<Sample>::fromUnit(value);
+			}
+		}
+	}
+}
+
+
+template<typename Sample>
+void rgbToGray(const unsigned char* rgb, const size_t nPixels, Sample* gray) {
+	toGray<3>(rgb, nPixels, gray);
+}
+
+
+size_t PixelFormat::bytesPerPixel() const {
+	switch (type) {
+	case SampleFormat::UInt8: return nChannels;
+	case SampleFormat::UInt16: return nChannels * 2;
+	case SampleFormat::Half: return nChannels * 2;
+	default: return nChannels * 4;
+	}
+}
+
+
+OIIO::TypeDesc typeDesc(const SampleFormat format) {
+	switch (format) {
+	case SampleFormat::UInt16: return OIIO::TypeDesc::UINT16;
+	case SampleFormat::Half: return OIIO::TypeDesc::HALF;
+	case SampleFormat::Float: return OIIO::TypeDesc::FLOAT;
+	default: return OIIO::TypeDesc::UINT8;
+	}
+}
+
+
+// How an image is decoded: in its own type where there is a sample
+// format for it, else as floats, and as gray or RGB without the alpha.
+PixelFormat readFormat(const OIIO::ImageSpec& spec) {
+	PixelFormat format;
+	switch (spec.format.basetype) {
+	case OIIO::TypeDesc::UINT8: format.type = SampleFormat::UInt8; break;
+	case OIIO::TypeDesc::UINT16: format.type = SampleFormat::UInt16; break;
+	case OIIO::TypeDesc::HALF: format.type = SampleFormat::Half; break;
+	default: format.type = SampleFormat::Float; break;
+	}
+	format.nChannels = spec.nchannels >= 3 ? 3 : 1;
+	return format;
+}
+
+
+bool readRows(OIIO::ImageInput& in, const PixelFormat& format, const int level, const int ybegin, const int yend, void* data) {
+	return in.read_scanlines(0, level, ybegin, yend, 0, 0, static_cast<int>(format.nChannels), typeDesc(format.type), data);
+}
+
+
+template<typename In, typename Sample>
+void pixelsToGray(const In* pixels, const size_t nChannels, const size_t nPixels, Sample* gray) {
+	switch (nChannels) {
+	case 1: return toGray<1>(pixels, nPixels, gray);
+	case 3: return toGray<3>(pixels, nPixels, gray);
+	default: return toGray<4>(pixels, nPixels, gray);
+	}
+}
+
+
+template<typename Sample>
+void pixelsToGray(const void* pixels, const PixelFormat& format, const size_t nPixels, Sample* gray) {
+	assert(format.nChannels == 1 || format.nChannels == 3 || format.nChannels == 4);
+
+	switch (format.type) {
+	case SampleFormat::UInt8: return pixelsToGray(static_cast<const uint8_t*>(pixels), format.nChannels, nPixels, gray);
+	case SampleFormat::UInt16: return pixelsToGray(static_cast<const uint16_t*>(pixels), format.nChannels, nPixels, gray);
+	case SampleFormat::Half: return pixelsToGray(static_cast<const Half*>(pixels), format.nChannels, nPixels, gray);
+	default: return pixelsToGray(static_cast<const float*>(pixels), format.nChannels, nPixels, gray);
+	}
+}
+
+
+template<typename In, typename Sample>
+void pixelsToChannels(const In* pixels, const size_t nChannels, const size_t nPixels, Sample* red, Sample* green, Sample* blue) {
+	switch (nChannels) {
+	case 1: return toChannels<1>(pixels, nPixels, red, green, blue);
+	case 3: return toChannels<3>(pixels, nPixels, red, green, blue);
+	default: return toChannels<4>(pixels, nPixels, red, green, blue);
+	}
+}
+
+
+template<typename Sample>
+void pixelsToChannels(const void* pixels, const PixelFormat& format, const size_t nPixels, Sample* red, Sample* green, Sample* blue) {
+	assert(format.nChannels == 1 || format.nChannels == 3 || format.nChannels == 4);
+
+	switch (format.type) {
+	case SampleFormat::UInt8: return pixelsToChannels(static_cast<const uint8_t*>(pixels), format.nChannels, nPixels, red, green, blue);
+	case SampleFormat::UInt16: return pixelsToChannels(static_cast<const uint16_t*>(pixels), format.nChannels, nPixels, red, green, blue);
+	case SampleFormat::Half: return pixelsToChannels(static_cast<const Half*>(pixels), format.nChannels, nPixels, red, green, blue);
+	default: return pixelsToChannels(static_cast<const float*>(pixels), format.nChannels, nPixels, red, green, blue);
+	}
+}
+
+
+// Weight of the shortest exposure of a bracket where it is clipped,
+// small enough to not matter where any exposure is not.
+constexpr float MINIMUM_WEIGHT = 1e-6f;
+
+
+// Adds the gray values of one exposure of a bracket, in [0, 1], to the
+// weighted sums of the radiance, value / exposure. Values near 0 or 1
+// say little about it, so they weigh little, and clipped ones nothing,
+// unless minimumWeight says otherwise.
+void addExposure(const float* values, const size_t nPixels, const float exposure, const float minimumWeight, float* sums, float* weights) {
+	const float inverse = 1.0f / exposure;
+	for (size_t i = 0; i < nPixels; ++i) {
+		const float weight = max(minimumWeight, 1.0f - std::abs(2.0f * values[i] - 1.0f));
+		sums[i] += weight * values[i] * inverse;
+		weights[i] += weight;
+	}
+}
+
+
+template<typename Sample>
+DatasetReader<Sample>::DatasetReader(const string& dir) {
+
+	const vector<string> items = listItems(dir);
+
+	// Images of the same lamp are its bracket, with their exposures.
+	// The lights keep the order of the files.
+	vector<pair<double, double>> lampAngles;
+	vector<vector<pair<double, string>>> brackets;
+	for (const string& item : items) {
+		const pair<double, double> angles = parseLampAngles(item);
+		const size_t k = find(lampAngles.begin(), lampAngles.end(), angles) - lampAngles.begin();
+		if (k == lampAngles.size()) {
+			lampAngles.push_back(angles);
+			brackets.emplace_back();
+		}
+		brackets[k].emplace_back(parseExposure(item), item);
+	}
+
+	if (brackets.size() < MIN_LIGHTS || MAX_LIGHTS < brackets.size()) {
+		throw invalid_argument{ "Expected " + std::to_string(MIN_LIGHTS) + " to " + std::to_string(MAX_LIGHTS) + " lights, found "
+			+ std::to_string(brackets.size()) + " in: " + dir };
+	}
+
+	double shortest = std::numeric_limits<double>::infinity();
+	for (auto& bracket : brackets) {
+		sort(bracket.begin(), bracket.end());
+		for (size_t i = 1; i < bracket.size(); ++i) {
+			if (bracket[i].first == bracket[i - 1].first) {
+				throw invalid_argument{ "Two images of a lamp with the same exposure: " + bracket[i].second };
+			}
+		}
+		shortest = min(shortest, bracket[0].first);
+	}
+
+	for (size_t k = 0; k < brackets.size(); ++k) {
+		lightDirections.push_back(incidentIlluminationDirection(lampAngles[k].first, lampAngles[k].second));
+		lights.emplace_back();
+		for (const auto& [exposure, file] : brackets[k]) {
+			OIIO::ImageInput::unique_ptr input = openImage(file);
+			const PixelFormat format = readFormat(input->spec());
+			lights[k].push_back(Image{ file, std::move(input), format, exposure / shortest });
+			traceFileBytes("bytes read", file);
+		}
+	}
+
+	const OIIO::ImageSpec& spec = lights[0][0].input->spec();
+	width = spec.width;
+	height = spec.height;
+
+	for (const auto& light : lights) {
+		for (const Image& image : light) {
+			if (image.input->spec().width != spec.width || image.input->spec().height != spec.height) {
+				throw invalid_argument("The files are not the same size!");
+			}
+		}
+	}
+}
+
+
+template<typename Sample>
+bool DatasetReader<Sample>::bracketed(const size_t k) const {
+	return lights[k].size() > 1 || lights[k][0].exposure != 1.0;
+}
+
+
+template<typename Sample>
+LightStack<Sample> DatasetReader<Sample>::makeBand(const size_t firstRow, const size_t nRows, vector<Sample> storage) const {
+	assert(firstRow + nRows <= height);
+
+	LightStack<Sample> band{ width, nRows, lights.size(), firstRow, std::move(storage) };
+	band.lightDirections = lightDirections;
+	return band;
+}
+
+
+template<typename Sample>
+vector<future<void>> DatasetReader<Sample>::startReadingBand(LightStack<Sample>& band, ThreadPool& pool, const RowsReady& onRowsReady) {
+	return startReading({ &band }, pool, onRowsReady);
+}
+
+
+template<typename Sample>
+void DatasetReader<Sample>::readChannels(vector<LightStack<Sample>>& channels, ThreadPool& pool) {
+	assert(channels.size() == 3);
+	for (size_t k = 0; k < lights.size(); ++k) {
+		if (bracketed(k)) throw invalid_argument{ "Exposure brackets are only merged to gray." };
+	}
+
+	vector<future<void>> decoders = startReading({ &channels[0], &channels[1], &channels[2] }, pool, nullptr);
+	waitAll(decoders);
+}
+
+
+template<typename Sample>
+vector<future<void>> DatasetReader<Sample>::startReading(const vector<LightStack<Sample>*>& bands, ThreadPool& pool, const RowsReady& onRowsReady) {
+	const LightStack<Sample>& band = *bands[0];
+	assert(all_of(bands.begin(), bands.end(), [&](const LightStack<Sample>* b) {
+		return b->width == width && b->nLights == lights.size() && b->height == band.height && b->firstRow == band.firstRow;
+	}));
+
+	const size_t nRows = band.height;
+	const size_t nChunks = (nRows + CHUNK_ROWS - 1) / CHUNK_ROWS;
+
+	// Number of lights that are done with each chunk. Value-initialized,
+	// i.e. all zero. Shared by the tasks, as they outlive this call.
+	const auto lightsDone = make_shared<vector<atomic<size_t>>>(nChunks);
+
+	vector<future<void>> decoders;
+	decoders.reserve(lights.size());
+
+	for (size_t k = 0; k < lights.size(); ++k) {
+		decoders.push_back(pool.enqueue([this, k, nRows, bands, &band, lightsDone, onRowsReady] {
+			// Decoded in chunks, so the pixels never get large, not
+			// even for all exposures of a bracket.
+			const size_t chunkPixels = width * min(CHUNK_ROWS, nRows);
+			size_t bytesPerPixel = 0;
+			for (const Image& image : lights[k]) {
+				bytesPerPixel = max(bytesPerPixel, image.format.bytesPerPixel());
+			}
+			vector<unsigned char> pixels(chunkPixels * bytesPerPixel);
+			vector<Sample> gray(chunkPixels * bands.size());
+			vector<float> scratch(bracketed(k) ? chunkPixels * 3 : 0);
+
+			for (size_t y = 0; y < nRows; y += CHUNK_ROWS) {
+				const size_t rows = min(CHUNK_ROWS, nRows - y);
+				const int ybegin = static_cast<int>(band.firstRow + y);
+				const int yend = static_cast<int>(band.firstRow + y + rows);
+
+				if (bracketed(k)) {
+					readBracket(k, ybegin, yend, pixels, scratch, &gray[0]);
+				}
+				else {
+					const Image& image = lights[k][0];
+					{
+						const TraceSpan span{ "decode" };
+						if (!readRows(*image.input, image.format, 0, ybegin, yend, &pixels[0])) {
+							throw invalid_argument{ "Cannot read file: " + image.file };
+						}
+					}
+					{
+						const TraceSpan span{ "gray" };
+						if (bands.size() == 3) {
+							pixelsToChannels(&pixels[0], image.format, width * rows, &gray[0], &gray[chunkPixels], &gray[chunkPixels * 2]);
+						}
+						else {
+							pixelsToGray(&pixels[0], image.format, width * rows, &gray[0]);
+						}
+					}
+				}
+
+				for (size_t c = 0; c < bands.size(); ++c) {
+					for (size_t i = 0; i < rows; ++i) {
+						bands[c]->setRow(k, y + i, &gray[c * chunkPixels + i * width]);
+					}
+				}
+
+				// The last light to finish a chunk hands it on.
+				if (++(*lightsDone)[y / CHUNK_ROWS] == lights.size() && onRowsReady) {
+					onRowsReady(y, y + rows);
+				}
+			}
+		}));
+	}
+
+	return decoders;
+}
+
+
+template<typename Sample>
+void DatasetReader<Sample>::readBracket(const size_t k, const int ybegin, const int yend, vector<unsigned char>& pixels, vector<float>& scratch, Sample* gray) {
+	const size_t nPixels = width * static_cast<size_t>(yend - ybegin);
+	assert(scratch.size() >= nPixels * 3);
+
+	// The gray of one exposure, the sums and weights of all of them.
+	float* const values = &scratch[0];
+	float* const sums = values + nPixels;
+	float* const weights = sums + nPixels;
+	std::fill(sums, weights + nPixels, 0.0f);
+
+	for (const Image& image : lights[k]) {
+		{
+			const TraceSpan span{ "decode" };
+			if (!readRows(*image.input, image.format, 0, ybegin, yend, &pixels[0])) {
+				throw invalid_argument{ "Cannot read file: " + image.file };
+			}
+		}
+
+		const TraceSpan span{ "merge" };
+		pixelsToGray(&pixels[0], image.format, nPixels, values);
+
+		// The shortest exposure always weighs a little, so where all
+		// exposures are clipped, it alone gives the radiance.
+		const float minimumWeight = &image == &lights[k][0] ? MINIMUM_WEIGHT : 0.0f;
+		addExposure(values, nPixels, static_cast<float>(image.exposure), minimumWeight, sums, weights);
 	}
 
+	const TraceSpan span{ "merge" };
+	for (size_t i = 0; i < nPixels; ++i) {
+		values[i] = sums[i] / weights[i];
+	}
+	pixelsToGray(values, PixelFormat{ SampleFormat::Float, 1 }, nPixels, gray);
+}
+
+
+template<typename Sample>
+std::optional<LightStack<Sample>> DatasetReader<Sample>::readReduced(const size_t maxSize) {
+	for (size_t k = 0; k < lights.size(); ++k) {
+		if (bracketed(k)) return std::nullopt;
+	}
+
+	// The other reads expect the full size.
+	const auto rewind = [this] {
+		for (const auto& light : lights) {
+			light[0].input->seek_subimage(0, 0);
+		}
+	};
+
+	OIIO::ImageInput& first = *lights[0][0].input;
+	int level = 0;
+	size_t levelWidth = width;
+	size_t levelHeight = height;
+	while (max(levelWidth, levelHeight) > maxSize) {
+		if (!first.seek_subimage(0, ++level)) {
+			rewind();
+			return std::nullopt;
+		}
+		levelWidth = first.spec().width;
+		levelHeight = first.spec().height;
+	}
+	if (level == 0) return std::nullopt;
+
+	LightStack<Sample> reduced{ levelWidth, levelHeight, lights.size() };
+	reduced.lightDirections = lightDirections;
+
+	vector<unsigned char> pixels;
+	vector<Sample> gray(levelWidth * levelHeight);
+
+	for (size_t k = 0; k < lights.size(); ++k) {
+		const Image& image = lights[k][0];
+		if (!image.input->seek_subimage(0, level) ||
+			static_cast<size_t>(image.input->spec().width) != levelWidth ||
+			static_cast<size_t>(image.input->spec().height) != levelHeight) {
+			rewind();
+			return std::nullopt;
+		}
+		pixels.resize(levelWidth * levelHeight * image.format.bytesPerPixel());
+		{
+			const TraceSpan span{ "decode" };
+			if (!readRows(*image.input, image.format, level, 0, static_cast<int>(levelHeight), &pixels[0])) {
+				rewind();
+				throw invalid_argument{ "Cannot read file: " + image.file };
+			}
+		}
+		{
+			const TraceSpan span{ "gray" };
+			pixelsToGray(&pixels[0], image.format, levelWidth * levelHeight, &gray[0]);
+		}
+
+		for (size_t y = 0; y < levelHeight; ++y) {
+			reduced.setRow(k, y, &gray[y * levelWidth]);
+		}
+	}
+
+	rewind();
+	return reduced;
+}
+
+
+template<typename Sample>
+void DatasetReader<Sample>::readBand(LightStack<Sample>& band, ThreadPool& pool, const RowsReady& onRowsReady) {
+	vector<future<void>> decoders = startReadingBand(band, pool, onRowsReady);
+
+	// The tasks use the band, so all of them have to be done
+	// before leaving, even if one of them failed.
+	waitAll(decoders);
+}
+
+
+template<typename Sample>
+LightStack<Sample> readDataset(const string& dir, ThreadPool& pool) {
+	cout << "Reading dataset.\n";
+
+	DatasetReader<Sample> reader{ dir };
+	LightStack<Sample> dataset = reader.makeBand(0, reader.height);
+	reader.readBand(dataset, pool);
+	return dataset;
+}
+
+
+template<typename Sample>
+LightStack<Sample> readDataset(const string& dir) {
+	const unsigned int parallelism = std::thread::hardware_concurrency();
+	assert(parallelism > 0);
+	ThreadPool pool{ parallelism };
+
+	return readDataset<Sample>(dir, pool);
+}
+
+
+template<typename Sample>
+ReflectionMap<Sample> readIntensities(const string & file) {
+	cout << "Reading image.\n";
+
+	const auto [azimuthalAngle, polarAngle] = parseLampAngles(file);
+	const OIIO::ImageInput::unique_ptr in = openImage(file);
+
 	// Error-checking-stuff is done.
 
+	const OIIO::ImageSpec& inSpec{ in->spec() };
 	const size_t width = inSpec.width;
 	const size_t height = inSpec.height;
 	const size_t nPixels = width * height;
-	const size_t nChars = nPixels * numChannels;
-
-	vector<unsigned char> data(nChars);
-	in->read_image(OIIO::TypeDesc::UINT8, &data[0]);
-	in->close();
-
-	vector<double> values;
-	values.reserve(nPixels);
 
-	const unsigned char* r = &data[0];
-	const unsigned char* g = r + 1;
-	const unsigned char* b = g + 1;
-	const unsigned char* end = r + (nChars);
+	const PixelFormat format = readFormat(inSpec);
+	vector<unsigned char> data(nPixels * format.bytesPerPixel());
+	{
+		const TraceSpan span{ "decode" };
+		if (!readRows(*in, format, 0, 0, static_cast<int>(height), &data[0])) {
+			throw invalid_argument{ "Cannot read file: " + file };
+		}
+		in->close();
+	}
+	traceFileBytes("bytes read", file);
 
-	for (; r != end; r += 3, g += 3, b += 3) {
-		const double gray = 0.299 * *r + 0.587 * *g + 0.114 * *b;
-		values.push_back(gray / 255);
+	vector<Sample> values(nPixels);
+	{
+		const TraceSpan span{ "gray" };
+		pixelsToGray(&data[0], format, nPixels, &values[0]);
 	}
 
-	return ReflectionMap{
+	return ReflectionMap<Sample>{
 		width,
 		height,
-		values,
-		degreesToRadians(azimuthalDegrees),
-		degreesToRadians(polarDegress)
+		std::move(values),
+		azimuthalAngle,
+		polarAngle
 	};
 }
 
 
-void writeNormalMap(const NormalMap& normalMap, const string& file) {
-	cout << "Writing image.\n";
+template void rgbToGray(const unsigned char*, const size_t, uint8_t*);
+template void rgbToGray(const unsigned char*, const size_t, uint16_t*);
+template void rgbToGray(const unsigned char*, const size_t, Half*);
+template void rgbToGray(const unsigned char*, const size_t, float*);
+
+template void pixelsToGray(const void*, const PixelFormat&, const size_t, uint8_t*);
+template void pixelsToGray(const void*, const PixelFormat&, const size_t, uint16_t*);
+template void pixelsToGray(const void*, const PixelFormat&, const size_t, Half*);
+template void pixelsToGray(const void*, const PixelFormat&, const size_t, float*);
+
+template void splitChannels(const unsigned char*, const size_t, uint8_t*, uint8_t*, uint8_t*);
+template void splitChannels(const unsigned char*, const size_t, uint16_t*, uint16_t*, uint16_t*);
+template void splitChannels(const unsigned char*, const size_t, Half*, Half*, Half*);
+template void splitChannels(const unsigned char*, const size_t, float*, float*, float*);
+
+template void pixelsToChannels(const void*, const PixelFormat&, const size_t, uint8_t*, uint8_t*, uint8_t*);
+template void pixelsToChannels(const void*, const PixelFormat&, const size_t, uint16_t*, uint16_t*, uint16_t*);
+template void pixelsToChannels(const void*, const PixelFormat&, const size_t, Half*, Half*, Half*);
+template void pixelsToChannels(const void*, const PixelFormat&, const size_t, float*, float*, float*);
+
+template class DatasetReader<uint8_t>;
+template class DatasetReader<uint16_t>;
+template class DatasetReader<Half>;
+template class DatasetReader<float>;
+
+template LightStack<uint8_t> readDataset(const string&);
+template LightStack<uint16_t> readDataset(const string&);
+template LightStack<Half> readDataset(const string&);
+template LightStack<float> readDataset(const string&);
+
+template LightStack<uint8_t> readDataset(const string&, ThreadPool&);
+template LightStack<uint16_t> readDataset(const string&, ThreadPool&);
+template LightStack<Half> readDataset(const string&, ThreadPool&);
+template LightStack<float> readDataset(const string&, ThreadPool&);
+
+template ReflectionMap<uint8_t> readIntensities(const string&);
+template ReflectionMap<uint16_t> readIntensities(const string&);
+template ReflectionMap<Half> readIntensities(const string&);
+template ReflectionMap<float> readIntensities(const string&);
+
+
+// Scales the components from [-1, 1] to the whole range of the integer
+// type, or keeps them for floats. No branches and no calls in the loop,
+// so the compiler can vectorize it.
+template<typename T>
+void quantize(const double* normals, const size_t n, T* out) {
+	if constexpr (std::is_floating_point<T>::value) {
+		for (size_t i = 0; i < n; ++i) {
+			out[i] = static_cast<T>(normals[i]);
+		}
+	}
+	else {
+		const int top = std::numeric_limits<T>::max();
+		for (size_t i = 0; i < n; ++i) {
+			// The normal can obviously have negative values.
+			// We scale from [-1, 1] into [0, 1]. Clamped as ints,
+			// which vectorizes, unlike clamping the doubles.
+			int value = static_cast<int>((normals[i] + 1) / 2 * top);
+			value = value > 0 ? value : 0;
+			value = value < top ? value : top;
+			out[i] = static_cast<T>(value);
+		}
+	}
+}
 
-	const std::unique_ptr<OIIO::ImageOutput> out = OIIO::ImageOutput::create(file);
+
+// Adds the rows [begin, end) of an RGB-level, each value as
+// value * scale + offset, to the sums of the next smaller level. That
+// has half the size, rounded down, so an odd last row or column goes
+// to the last pixel too.
+template<typename T>
+void addToNextLevel(
+	const T* rows,
+	const size_t begin,
+	const size_t end,
+	const size_t width,
+	const size_t nextWidth,
+	const size_t nextHeight,
+	const float scale,
+	const float offset,
+	vector<float>& sums)
+{
+	for (size_t y = begin; y < end; ++y) {
+		float* next = &sums[min(y / 2, nextHeight - 1) * nextWidth * 3];
+		const T* row = rows + (y - begin) * width * 3;
+
+		for (size_t x = 0; x < width; ++x) {
+			float* pixel = next + min(x / 2, nextWidth - 1) * 3;
+			pixel[0] += static_cast<float>(row[x * 3 + 0]) * scale + offset;
+			pixel[1] += static_cast<float>(row[x * 3 + 1]) * scale + offset;
+			pixel[2] += static_cast<float>(row[x * 3 + 2]) * scale + offset;
+		}
+	}
+}
+
+
+// Turns the sums of addToNextLevel into averages.
+void averageLevel(vector<float>& sums, const size_t width, const size_t height, const size_t nextWidth, const size_t nextHeight) {
+	for (size_t y = 0; y < nextHeight; ++y) {
+		const size_t rows = y + 1 == nextHeight ? height - 2 * y : 2;
+
+		for (size_t x = 0; x < nextWidth; ++x) {
+			const size_t columns = x + 1 == nextWidth ? width - 2 * x : 2;
+			const float weight = 1.0f / (rows * columns);
+
+			float* pixel = &sums[(y * nextWidth + x) * 3];
+			pixel[0] *= weight;
+			pixel[1] *= weight;
+			pixel[2] *= weight;
+		}
+	}
+}
+
+
+size_t halved(const size_t size) {
+	return max<size_t>(1, size / 2);
+}
+
+
+NormalMapWriter::NormalMapWriter(const string& file, const size_t width, const size_t height, const OutputFormat& format)
+	:
+	file(file), width(width), height(height), format(format)
+{
+	const bool floats = format.sampleFormat == SampleFormat::Half || format.sampleFormat == SampleFormat::Float;
+	if (floats && !storesFloats(file)) throw invalid_argument{ "Floats need a format like EXR or TIFF: " + file };
+
+	const OIIO::TypeDesc fileType = typeDesc(format.sampleFormat);
+	bufferType = floats ? OIIO::TypeDesc::FLOAT : fileType;
+	rowBytes = width * 3 * bufferType.size();
+
+	out = OIIO::ImageOutput::create(file);
 	if (! out) throw invalid_argument{ "Cannot create file: " + file };
-	const OIIO::ImageSpec spec(normalMap.width, normalMap.height, 3, OIIO::TypeDesc::UINT8);
 
-	const size_t nNormals = normalMap.normalsData.size();
+	OIIO::ImageSpec spec(static_cast<int>(width), static_cast<int>(height), 3, fileType);
+	if (format.layout != Layout::Scanlines) {
+		if (!out->supports("tiles")) throw invalid_argument{ "The format has no tiles: " + file };
+		if (format.layout == Layout::MipMap && !out->supports("mipmap")) throw invalid_argument{ "The format has no mip-maps: " + file };
+		spec.tile_width = static_cast<int>(TILE_SIZE);
+		spec.tile_height = static_cast<int>(TILE_SIZE);
+	}
+	if (!out->open(file, spec)) throw invalid_argument{ "Cannot create file: " + file };
 
-	vector<unsigned char> data;
-	data.reserve(nNormals);
+	if (format.layout == Layout::MipMap) {
+		nextLevel.assign(halved(width) * halved(height) * 3, 0.0f);
+	}
+}
+
+
+void NormalMapWriter::write(const NormalMapView& band, const size_t firstRow) {
+	assert(band.width == width);
+	assert(firstRow + band.height <= height);
+
+	const size_t nValues = band.width * band.height * 3;
+	const double* normals = band.normalsData;
 
-	const double* x_p = &normalMap.normalsData[0];
-	const double* y_p = x_p + 1;
-	const double* z_p = y_p + 1;
-	const double* end = x_p + (nNormals);
+	vector<unsigned char> data(nValues * bufferType.size());
+	{
+		const TraceSpan span{ "quantize" };
+		switch (bufferType.basetype) {
+		case OIIO::TypeDesc::UINT16: quantize(normals, nValues, reinterpret_cast<uint16_t*>(&data[0])); break;
+		case OIIO::TypeDesc::FLOAT: quantize(normals, nValues, reinterpret_cast<float*>(&data[0])); break;
+		default: quantize(normals, nValues, &data[0]); break;
+		}
+	}
+
+	writeRows(&data[0], firstRow, firstRow + band.height);
 
-	for (; x_p != end; x_p += 3, y_p += 3, z_p += 3) {
-		// The normal can obviously have negative values.
-		// We scale from [-1, 1] into [0, 1].
-		const double x = (*x_p + 1) / 2;
-		const double y = (*y_p + 1) / 2;
-		const double z = (*z_p + 1) / 2;
+	if (format.layout == Layout::MipMap) {
+		const TraceSpan span{ "mip-map" };
+		// The levels get the values like the file, before quantizing.
+		const bool floats = bufferType == OIIO::TypeDesc::FLOAT;
+		addToNextLevel(normals, firstRow, firstRow + band.height, width, halved(width), halved(height),
+			floats ? 1.0f : 0.5f, floats ? 0.0f : 0.5f, nextLevel);
+	}
+}
+
+
+void NormalMapWriter::writeRows(const unsigned char* data, const size_t begin, const size_t end) {
+	const TraceSpan span{ "encode" };
+	if (format.layout == Layout::Scanlines) {
+		if (!out->write_scanlines(static_cast<int>(begin), static_cast<int>(end), 0, bufferType, data)) {
+			throw invalid_argument{ "Cannot write file: " + file };
+		}
+		return;
+	}
+
+	assert(begin == pendingBegin + pending.size() / rowBytes);
+	pending.insert(pending.end(), data, data + (end - begin) * rowBytes);
+
+	// Only whole rows of tiles, but the last one may be cut off by the image.
+	const size_t complete = end == height ? height : end / TILE_SIZE * TILE_SIZE;
+	if (complete > pendingBegin) {
+		if (!out->write_tiles(0, static_cast<int>(width), static_cast<int>(pendingBegin), static_cast<int>(complete), 0, 1, bufferType, &pending[0])) {
+			throw invalid_argument{ "Cannot write file: " + file };
+		}
+		pending.erase(pending.begin(), pending.begin() + (complete - pendingBegin) * rowBytes);
+		pendingBegin = complete;
+	}
+}
 
-		// If this ever throws, make it an if.
-		// Or prove that it can never happen in our setup.
-		// Negative z is actually impossible.
-		assert(x >= 0.0);
-		assert(y >= 0.0);
-		//assert(z >= 0.0);
 
-		data.push_back(static_cast<unsigned char>(x * 255));
-		data.push_back(static_cast<unsigned char>(y * 255));
-		data.push_back(static_cast<unsigned char>(z * 255));
+void NormalMapWriter::writeMipLevels() {
+	vector<float> sums = std::move(nextLevel);
+	size_t levelWidth = width;
+	size_t levelHeight = height;
+
+	while (levelWidth > 1 || levelHeight > 1) {
+		const size_t nextWidth = halved(levelWidth);
+		const size_t nextHeight = halved(levelHeight);
+		averageLevel(sums, levelWidth, levelHeight, nextWidth, nextHeight);
+
+		OIIO::ImageSpec spec(static_cast<int>(nextWidth), static_cast<int>(nextHeight), 3, out->spec().format);
+		spec.tile_width = static_cast<int>(TILE_SIZE);
+		spec.tile_height = static_cast<int>(TILE_SIZE);
+		if (!out->open(file, spec, OIIO::ImageOutput::AppendMIPLevel) ||
+			!out->write_tiles(0, static_cast<int>(nextWidth), 0, static_cast<int>(nextHeight), 0, 1, OIIO::TypeDesc::FLOAT, &sums[0])) {
+			throw invalid_argument{ "Cannot write file: " + file };
+		}
+
+		if (nextWidth > 1 || nextHeight > 1) {
+			vector<float> next(halved(nextWidth) * halved(nextHeight) * 3, 0.0f);
+			addToNextLevel(&sums[0], 0, nextHeight, nextWidth, halved(nextWidth), halved(nextHeight), 1.0f, 0.0f, next);
+			sums = std::move(next);
+		}
+		levelWidth = nextWidth;
+		levelHeight = nextHeight;
+	}
+}
+
+
+void NormalMapWriter::close() {
+	assert(pending.empty());
+	{
+		const TraceSpan span{ "encode" };
+		if (format.layout == Layout::MipMap) {
+			writeMipLevels();
+		}
+		out->close();
+	}
+	traceFileBytes("bytes written", file);
+}
+
+
+void writeNormalMap(const NormalMapView& normalMap, const string& file, const OutputFormat& format) {
+	cout << "Writing image.\n";
+
+	NormalMapWriter writer{ file, normalMap.width, normalMap.height, format };
+	writer.write(normalMap, 0);
+	writer.close();
+}
+
+
+AlbedoMapWriter::AlbedoMapWriter(const string& file, const size_t width, const size_t height, const size_t nChannels)
+	:
+	file(file), width(width), height(height), nChannels(nChannels)
+{
+	out = OIIO::ImageOutput::create(file);
+	if (!out) throw invalid_argument{ "Cannot create file: " + file };
+	const OIIO::ImageSpec spec(static_cast<int>(width), static_cast<int>(height), static_cast<int>(nChannels), OIIO::TypeDesc::UINT16);
+	if (!out->open(file, spec)) throw invalid_argument{ "Cannot create file: " + file };
+}
+
+
+void AlbedoMapWriter::write(const AlbedoMapView& band, const size_t firstRow) {
+	assert(band.width == width);
+	assert(band.nChannels == nChannels);
+	assert(firstRow + band.height <= height);
+
+	// Converted (and clamped to [0, 1]) by OIIO.
+	const TraceSpan span{ "encode" };
+	const int ybegin = static_cast<int>(firstRow);
+	const int yend = static_cast<int>(firstRow + band.height);
+	if (!out->write_scanlines(ybegin, yend, 0, OIIO::TypeDesc::DOUBLE, band.albedoData)) {
+		throw invalid_argument{ "Cannot write file: " + file };
+	}
+}
+
+
+void AlbedoMapWriter::close() {
+	{
+		const TraceSpan span{ "encode" };
+		out->close();
+	}
+	traceFileBytes("bytes written", file);
+}
+
+
+void writeAlbedoMap(const AlbedoMapView& albedoMap, const string& file) {
+	cout << "Writing albedo.\n";
+
+	AlbedoMapWriter writer{ file, albedoMap.width, albedoMap.height, albedoMap.nChannels };
+	writer.write(albedoMap, 0);
+	writer.close();
+}
+
+
+void writeHeightMap(const HeightMap& heightMap, const string& file) {
+	cout << "Writing heights.\n";
+	const TraceSpan span{ "encode" };
+
+	const bool floats = storesFloats(file);
+	vector<float> data = heightMap.heightData;
+
+	if (!floats && !data.empty()) {
+		const auto range = minmax_element(data.begin(), data.end());
+		const float lowest = *range.first;
+		const float extent = *range.second - lowest;
+		cout << "Heights from " << lowest << " to " << lowest + extent << " pixels, scaled to [0, 1].\n";
+		for (float& value : data) {
+			value = extent > 0.0f ? (value - lowest) / extent : 0.0f;
+		}
 	}
 
-	out->open(file, spec);
-	out->write_image(OIIO::TypeDesc::UINT8, &data[0]);
+	auto out = OIIO::ImageOutput::create(file);
+	if (!out) throw invalid_argument{ "Cannot create file: " + file };
+	const OIIO::TypeDesc format = floats ? OIIO::TypeDesc::FLOAT : OIIO::TypeDesc::UINT16;
+	const OIIO::ImageSpec spec(static_cast<int>(heightMap.width), static_cast<int>(heightMap.height), 1, format);
+	if (!out->open(file, spec)) throw invalid_argument{ "Cannot create file: " + file };
+	if (!out->write_image(OIIO::TypeDesc::FLOAT, &data[0])) throw invalid_argument{ "Cannot write file: " + file };
 	out->close();
+	traceFileBytes("bytes written", file);
 }
\ No newline at end of file
@@ -2,11 +2,235 @@
 
 #include <vector>
 #include <string>
+#include <memory>
+#include <utility>
 #include "ReflectionMap.hpp"
+#include "LightStack.hpp"
 #include "NormalMap.hpp"
+#include "AlbedoMap.hpp"
+#include "HeightMap.hpp"
+#include "Vec.hpp"
+
+#include "../submodules/ThreadPool/ThreadPool.h"
+
+#include <OpenImageIO/imageio.h>
+
+#include <functional>
+#include <optional>
 
 
 std::vector<std::string> listItems(const std::string& dir);
-std::vector<ReflectionMap> readDataset(const std::string& dir);
-ReflectionMap readIntensities(const std::string& file);
-void writeNormalMap(const NormalMap& normalMap, const std::string& file);
\ No newline at end of file
+SampleFormat parseSampleFormat(const std::string& s);
+
+
+// How the pixels are arranged in the file. Tiles and mip-maps
+// need a format that has them, like EXR or TIFF.
+enum class Layout { Scanlines, Tiles, MipMap };
+Layout parseLayout(const std::string& s);
+
+
+// How the normal-map is stored. Integer formats get the normals scaled
+// from [-1, 1] to [0, 1], floats (f16, f32) get them as they are and
+// need a format with floats, like EXR or TIFF.
+struct OutputFormat {
+	SampleFormat sampleFormat = SampleFormat::UInt8;
+	Layout layout = Layout::Scanlines;
+};
+
+// True for files in formats that store floats (EXR, TIFF, HDR, PFM).
+bool storesFloats(const std::string& file);
+
+// Parses the lamp's direction out of a file name like
+// "name_azimuthalAngle_polarAngle.ext", angles in radians.
+// An exposure may follow the angles, see parseExposure.
+std::pair<double, double> parseLampAngles(const std::string& file);
+
+// Parses the exposure out of a file name like
+// "name_azimuthalAngle_polarAngle_exposure.ext", e.g. the exposure time,
+// only relative to the other images. 1 if there is none. Images of the
+// same lamp with different exposures are a bracket, merged into one.
+double parseExposure(const std::string& file);
+
+// Opens the image and checks that we can handle its format:
+// gray or RGB, each maybe with alpha, in any bit depth.
+OIIO::ImageInput::unique_ptr openImage(const std::string& file);
+
+// Decodes all images of the dataset in parallel on the pool.
+template<typename Sample>
+LightStack<Sample> readDataset(const std::string& dir, ThreadPool& pool);
+
+template<typename Sample>
+LightStack<Sample> readDataset(const std::string& dir);
+
+template<typename Sample>
+ReflectionMap<Sample> readIntensities(const std::string& file);
+
+void writeNormalMap(const NormalMapView& normalMap, const std::string& file, const OutputFormat& format = {});
+void writeAlbedoMap(const AlbedoMapView& albedoMap, const std::string& file);
+
+// Formats with floats get the heights in pixels,
+// all others get them scaled to [0, 1] with 16 bits where possible.
+void writeHeightMap(const HeightMap& heightMap, const std::string& file);
+
+// Converts nPixels 8-bit RGB-pixels into gray samples.
+template<typename Sample>
+void rgbToGray(const unsigned char* rgb, const std::size_t nPixels, Sample* gray);
+
+// Pixels as they come from a camera or a file.
+struct PixelFormat {
+	SampleFormat type = SampleFormat::UInt8;
+
+	// 1 for gray, 3 for RGB and 4 for RGBA, whose alpha is ignored.
+	std::size_t nChannels = 3;
+
+	std::size_t bytesPerPixel() const;
+};
+
+// Converts nPixels pixels of the format into gray samples, clamped to
+// [0, 1]. 8-bit RGB gives the same samples as rgbToGray.
+template<typename Sample>
+void pixelsToGray(const void* pixels, const PixelFormat& format, const std::size_t nPixels, Sample* gray);
+
+// Converts nPixels 8-bit RGB-pixels into samples per channel.
+template<typename Sample>
+void splitChannels(const unsigned char* rgb, const std::size_t nPixels, Sample* red, Sample* green, Sample* blue);
+
+// Like splitChannels for pixels of any format, clamped to [0, 1].
+// Gray goes into all three channels.
+template<typename Sample>
+void pixelsToChannels(const void* pixels, const PixelFormat& format, const std::size_t nPixels, Sample* red, Sample* green, Sample* blue);
+
+
+// Reads a dataset band by band. All images are opened
+// up front and stay open, so a band is decoded straight
+// from the files without ever holding a whole image.
+template<typename Sample>
+class DatasetReader {
+public:
+	// Rows of an image decoded at once.
+	static constexpr std::size_t CHUNK_ROWS = 64;
+
+	// A dataset has one image per light, or one bracket of
+	// exposures, which count as one light.
+	static constexpr std::size_t MIN_LIGHTS = 3;
+	static constexpr std::size_t MAX_LIGHTS = 64;
+
+	// Gets the rows [begin, end) of the band, relative to its first row.
+	using RowsReady = std::function<void(std::size_t begin, std::size_t end)>;
+
+	std::size_t width;
+	std::size_t height;
+	std::vector<Vec3> lightDirections;
+
+	explicit DatasetReader(const std::string& dir);
+
+	// An empty band for the rows [firstRow, firstRow + nRows),
+	// see LightStack for storage.
+	LightStack<Sample> makeBand(const std::size_t firstRow, const std::size_t nRows, std::vector<Sample> storage = {}) const;
+
+	// Decodes the rows of the band from all images, one task per image
+	// on the pool, and returns when all are done. As soon as a chunk of
+	// rows is there for every light, onRowsReady is called for it from
+	// the pool, so work on these rows can start while the rest is still
+	// decoding. Bands have to be read from top to bottom.
+	void readBand(LightStack<Sample>& band, ThreadPool& pool, const RowsReady& onRowsReady = nullptr);
+
+	// Like readBand, but returns right away with the futures of the
+	// decoding tasks. The band has to stay alive until all are done.
+	std::vector<std::future<void>> startReadingBand(LightStack<Sample>& band, ThreadPool& pool, const RowsReady& onRowsReady);
+
+	// Like readBand, but into three bands of the same rows, one
+	// per channel: red, green and blue instead of gray. Not for
+	// brackets, they are only merged to gray.
+	void readChannels(std::vector<LightStack<Sample>>& channels, ThreadPool& pool);
+
+	// Decodes the whole dataset from the largest mip-map level of the
+	// images with both edges at most maxSize, which is quick as only
+	// that level is read. Formats like TIFF or EXR can have mip-maps,
+	// others like JPEG can't, then there is nothing. Nothing for
+	// brackets as well.
+	std::optional<LightStack<Sample>> readReduced(const std::size_t maxSize);
+
+private:
+	struct Image {
+		std::string file;
+		OIIO::ImageInput::unique_ptr input;
+		PixelFormat format;
+
+		// Relative to the shortest exposure of the dataset, so at least 1.
+		double exposure;
+	};
+
+	// The images of each light, more than one for a bracket,
+	// shortest exposure first.
+	std::vector<std::vector<Image>> lights;
+
+	// True if the light's samples have to be merged from exposures,
+	// not just converted from its one image.
+	bool bracketed(const std::size_t k) const;
+
+	// Decodes the rows [ybegin, yend) of the light's bracket and merges
+	// them into gray. Only these rows of each exposure are there at a
+	// time, with the sums and weights of the merge in the scratch.
+	void readBracket(const std::size_t k, const int ybegin, const int yend, std::vector<unsigned char>& pixels, std::vector<float>& scratch, Sample* gray);
+
+	// Gray with one band, the channels with three.
+	std::vector<std::future<void>> startReading(const std::vector<LightStack<Sample>*>& bands, ThreadPool& pool, const RowsReady& onRowsReady);
+};
+
+
+// Writes a normal-map band by band, from top to bottom. With tiles,
+// rows are held back until a whole row of tiles is there. For the
+// mip-map, every band is also added into the next smaller level, so
+// only that one is kept, and all smaller levels are written by close.
+class NormalMapWriter {
+public:
+	// Edge of the square tiles.
+	static constexpr std::size_t TILE_SIZE = 64;
+
+	NormalMapWriter(const std::string& file, const std::size_t width, const std::size_t height, const OutputFormat& format = {});
+
+	// Writes the band as the rows [firstRow, firstRow + band.height).
+	void write(const NormalMapView& band, const std::size_t firstRow);
+	void close();
+
+private:
+	const std::string file;
+	const std::size_t width;
+	const std::size_t height;
+	const OutputFormat format;
+	std::unique_ptr<OIIO::ImageOutput> out;
+
+	// What write_scanlines and write_tiles get, OIIO converts to the file's type.
+	OIIO::TypeDesc bufferType;
+	std::size_t rowBytes;
+
+	// Rows [pendingBegin, pendingBegin + pending.size() / rowBytes) aren't written yet.
+	std::vector<unsigned char> pending;
+	std::size_t pendingBegin = 0;
+
+	// Sums of the pixels of level 1 of the mip-map.
+	std::vector<float> nextLevel;
+
+	void writeRows(const unsigned char* data, const std::size_t begin, const std::size_t end);
+	void writeMipLevels();
+};
+
+
+// Writes an albedo-map band by band, from top to bottom. The
+// values are stored with 16 bits where the format allows it.
+class AlbedoMapWriter {
+public:
+	AlbedoMapWriter(const std::string& file, const std::size_t width, const std::size_t height, const std::size_t nChannels = 1);
+
+	// Writes the band as the rows [firstRow, firstRow + band.height).
+	void write(const AlbedoMapView& band, const std::size_t firstRow);
+	void close();
+
+private:
+	const std::string file;
+	const std::size_t width;
+	const std::size_t height;
+	const std::size_t nChannels;
+	std::unique_ptr<OIIO::ImageOutput> out;
+};
\ No newline at end of file
@@ -1,5 +1,9 @@
 #include "io.hpp"
 #include "util.hpp"
+#include "solve.hpp"
+#include "pipeline.hpp"
+#include "daemon.hpp"
+#include "trace.hpp"
 
 #include <iostream>
 using std::cout;
@@ -8,202 +12,142 @@ using std::cerr;
 #include <stdexcept>
 using std::invalid_argument;
 
-#include <vector>
-using std::vector;
-
 #include <string>
 using std::string;
 
-#include <cmath>
-using std::sin;
-using std::cos;
-
-#include "../submodules/ThreadPool/ThreadPool.h"
-using std::future;
-
-#include <chrono>
-using std::chrono::steady_clock;
-using std::chrono::duration_cast;
-using std::chrono::microseconds;
-
-// width and height of the image are scaled into [-1, 1].
-// that means the first pixel in x-axis / y-axis is always -1; 
-double distanceBetweenPixelPair(const size_t& length) {
-
-	// Pixel at Position 0
-	const double firstPixelPos = -1;
-
-	// Pixel at Position 1 
-	const double secondPixelPos = ((static_cast<double>(1) / (length - 1)) * 2 - 1);
-	const double distanceBetweenPixels = secondPixelPos - firstPixelPos;
-
-	return distanceBetweenPixels;
-}
-
-vector<Mat> correctionMatricesX(const size_t& height, const double scaledCorrectionFactor) {
-
-	vector<Mat> correctionMatricesX;
-	const double distanceBetweenPixelsX = distanceBetweenPixelPair(height);
-	double correctionIntensityX = -1;
-	for (int y = 0; y < height; y++) {
-		correctionMatricesX.push_back(Mat::rotationX(scaledCorrectionFactor * correctionIntensityX));
-		correctionIntensityX += distanceBetweenPixelsX;
-	}
-
-	return correctionMatricesX;
-
-}
-
-vector<Mat> correctionMatricesY(const size_t& width, const double correctionFactor) {
-
-	vector<Mat> correctionMatricesY;
-
-	// we determine the distance between 2 pixels
-	// the distance information is used to determine the correction intensity for each pixel
-	const double distanceBetweenPixelsY = distanceBetweenPixelPair(width);
-
-	// -1 and 1 have the same correction intensity, whereas the mathematical sign influences the 'intensity's direction'
-	// intensity value of -1 and 1 have the strongest intensity and a value of 0 has no intensity
-	// -> the further the pixel is away from the center, the higher the correction intensity is 
-	double correctionIntensityY = -1;
-	for (int x = 0; x < width; x++) {
-		correctionMatricesY.push_back(Mat::rotationY(correctionFactor * correctionIntensityY));
-		correctionIntensityY += distanceBetweenPixelsY;
-	}
-
-	return correctionMatricesY;
-
-}
-
-double calcSizeRatio(const size_t& height, const size_t& width) {
-	//check if height and width are even numbers
-	const size_t heightCalc = height % 2 != 0 ? height - 1 : height;
-	const size_t widthCalc = width % 2 != 0 ? width - 1 : width;
-
-	const double sizeRatio = static_cast<double>(heightCalc) / widthCalc;
-	return sizeRatio;
-}
-
-NormalMap photometricStereo(const vector<ReflectionMap>& dataset, const double correctionFactor) {
+#include <vector>
+using std::vector;
 
-	const size_t nImages = dataset.size();
-	const size_t width = dataset[0].width;
-	const size_t height = dataset[0].height;
 
-	vector<Vec> lightDirs;
-	lightDirs.reserve(dataset.size());
+int main(int argc, char* argv[]) {
+	const bool batch = argc >= 3 && string{ argv[1] } == "--batch";
+	const bool daemon = argc >= 3 && string{ argv[1] } == "--daemon";
+	const int firstOption = batch || daemon ? 3 : 4;
 
-	for (int i = 0; i < nImages; ++i) {
-		lightDirs.push_back(dataset[i].incidentIlluminationDirection());
+	if (argc < firstOption || (argc - firstOption) % 2 != 0) {
+		cerr << "Pass a path to the dataset, path for the result and a factor for correction." << '\n';
+		cerr << "The correction may be a list \"0,5,10\" or a range \"0:30:5\" to write one result per angle." << '\n';
+		cerr << "Or pass --batch and a file with one line \"dataset;result;correction[;albedo[;height]]\" per dataset." << '\n';
+		cerr << "Or pass --daemon and a path for a socket to take such lines as jobs, one after another." << '\n';
+		cerr << "Options: --precision double|float, --isa scalar|avx2|avx512, --samples u8|u16|f16|f32," << '\n';
+		cerr << "         --channels gray|rgb, --band <rows>, --shadow <0..1>, --specular <0..1>, --albedo <file>," << '\n';
+		cerr << "         --height <file>, --depth u8|u16|f16|f32, --layout scanlines|tiles|mipmap," << '\n';
+		cerr << "         --cache <directory>, --preview <file>, --incremental yes|no, --trace <file>, --summary <file>" << '\n';
+		return EXIT_FAILURE;
 	}
 
-	vector<double> L_data;
-	L_data.reserve(nImages * 3);
-
-	for (int i = 0; i < nImages; ++i) {
-		L_data.push_back(lightDirs[i][0]);
-		L_data.push_back(lightDirs[i][1]);
-		L_data.push_back(lightDirs[i][2]);
+	RunOptions options;
+	string traceFile;
+	string summaryFile;
+	if (!batch && !daemon) {
+		options.datasetDirectory = argv[1];
+		options.outNormalMap = argv[2];
 	}
 
-	const Mat L{ nImages, 3, L_data };
-	const Mat L_transposed = L.transpose();
-	const Mat L_inverse = (L_transposed * L).inverse();
-	const Mat L_inverseTransposed = L_inverse * L_transposed;
-	
-	
-	vector<double> normalsData;
-	normalsData.reserve(height * width * 3);
-
-	const unsigned int parallelism = std::thread::hardware_concurrency();
-	assert(parallelism > 0);
-	ThreadPool pool{ parallelism };
-	vector< future< vector<double> > > futures;
-	futures.reserve(height);
-
-	cout << "Calculating ... (" << parallelism << " threads)\n";
-
-	
-	vector<Mat> rotY = correctionMatricesY(width, correctionFactor);
-	vector<Mat> rotX = correctionMatricesX(height, correctionFactor * calcSizeRatio(height, width));
-
-	for (int y = 0; y < height; ++y) {
-
-		future<vector<double>> future = pool.enqueue(
-			[y, width, nImages, &dataset, &L_inverseTransposed, &rotX, &rotY] {
-				
-				vector<double> row;
-				row.reserve(width * 3);
-
-				int index = y * width;
-				
-				for (int x = 0; x < width; ++x) {
-
-					vector<double> reflections;
-					reflections.reserve(nImages);
-
-					for (int k = 0; k < nImages; ++k) {
-						reflections.push_back(dataset[k].intensities[index]);
-					}
-					++index;
-
-					// This is what you saw in the paper by Woodham (1980).
-					const Vec n = L_inverseTransposed * Vec{ reflections };
-					
-					//orientation correction
-					const Vec normal = (rotX[y] * (rotY[x] * n)).normalize();
-				
-					row.push_back(normal[0]);
-					row.push_back(normal[1]);
-					row.push_back(normal[2]);
-				}
-
-				return row;
+	try {
+		if (!batch && !daemon) {
+			const vector<int> degrees = parseDegrees(argv[3]);
+			if (degrees.size() == 1) {
+				options.correctionRadians = degreesToRadians(degrees[0]);
+			}
+			else {
+				options.sweepDegrees = degrees;
 			}
-		);
-
-		futures.push_back(std::move(future));
-	}
-
-	for (int i = 0; i < height; ++i) {
-		const vector<double> row = futures[i].get();
-
-		for (const double d : row) {
-			normalsData.push_back(d);
 		}
-	}
 
-	return NormalMap{ width, height, normalsData };
-}
+		for (int i = firstOption; i < argc; i += 2) {
+			const string option{ argv[i] };
+			const string value{ argv[i + 1] };
 
-int main(int argc, char* argv[]) {
-	if (argc != 4) {
-		cerr << "Pass a path to the dataset, path for the result and a factor for correction." << '\n';
-		return EXIT_FAILURE;
-	}
-
-	vector<ReflectionMap> dataset;
-	const string datasetDirectory{ argv[1] };
-	const string outNormalMap{ argv[2] };
-	const double correctionRadians = degreesToRadians(std::stoi(argv[3]));
+			if (option == "--precision") {
+				options.precision = parsePrecision(value);
+			}
+			else if (option == "--isa") {
+				options.isa = parseInstructionSet(value);
+			}
+			else if (option == "--samples") {
+				options.sampleFormat = parseSampleFormat(value);
+			}
+			else if (option == "--shadow") {
+				options.rejection.enabled = true;
+				options.rejection.shadowThreshold = std::stod(value);
+			}
+			else if (option == "--specular") {
+				options.rejection.enabled = true;
+				options.rejection.specularThreshold = std::stod(value);
+			}
+			else if (option == "--channels") {
+				if (value != "gray" && value != "rgb") throw invalid_argument{ "Unknown channels: " + value };
+				options.color = value == "rgb";
+			}
+			else if (option == "--incremental") {
+				if (value != "yes" && value != "no") throw invalid_argument{ "Expected yes or no: " + value };
+				options.incremental = value == "yes";
+			}
+			else if (option == "--albedo") {
+				options.outAlbedoMap = value;
+			}
+			else if (option == "--height") {
+				options.outHeightMap = value;
+			}
+			else if (option == "--depth") {
+				options.output.sampleFormat = parseSampleFormat(value);
+			}
+			else if (option == "--layout") {
+				options.output.layout = parseLayout(value);
+			}
+			else if (option == "--preview") {
+				options.outPreviewMap = value;
+			}
+			else if (option == "--trace") {
+				traceFile = value;
+			}
+			else if (option == "--summary") {
+				summaryFile = value;
+			}
+			else if (option == "--cache") {
+				options.cacheDirectory = value;
+			}
+			else if (option == "--band") {
+				options.bandRows = std::stoul(value);
+			}
+			else {
+				throw invalid_argument{ "Unknown option: " + option };
+			}
+		}
 
-	try {
-		dataset = readDataset(datasetDirectory);
-	}
-	catch (invalid_argument e) {
-		cerr << e.what() << '\n';
-		return EXIT_FAILURE;
-	}
-	
-	steady_clock::time_point begin = steady_clock::now();
+		if (!traceFile.empty() || !summaryFile.empty()) {
+			enableTracing();
+		}
 
-	const NormalMap nmap = photometricStereo(dataset, correctionRadians);
+		const auto writeTrace = [&] {
+			if (!traceFile.empty()) {
+				writeChromeTrace(traceFile);
+			}
+			if (!summaryFile.empty()) {
+				writeTraceSummary(summaryFile);
+			}
+		};
 
-	steady_clock::time_point end = steady_clock::now();
-	cout << "Calculation Time Normalmap (sec) = " << (duration_cast<microseconds>(end - begin).count()) / 1000000.0 << std::endl;
+		size_t failed = 0;
+		if (batch) {
+			failed = runBatch(readManifest(argv[2]), options);
+		}
+		else if (daemon) {
+			// The trace of each job replaces the one before, so it is
+			// there even if the daemon is killed.
+			runDaemon(argv[2], options, writeTrace);
+		}
+		else {
+			run(options);
+		}
 
-	try {
-		writeNormalMap(nmap, outNormalMap);
+		if (!daemon) {
+			writeTrace();
+		}
+		if (failed > 0) {
+			return EXIT_FAILURE;
+		}
 	}
 	catch (invalid_argument e) {
 		cerr << e.what() << '\n';
@@ -0,0 +1,1073 @@
+#include "pipeline.hpp"
+#include "io.hpp"
+#include "util.hpp"
+#include "integrate.hpp"
+#include "accumulate.hpp"
+#include "BackgroundWriter.hpp"
+#include "cache.hpp"
+#include "trace.hpp"
+using std::vector;
+using std::string;
+using std::stoi;
+using std::size_t;
+using std::uint8_t;
+using std::uint16_t;
+
+#include <iostream>
+using std::cout;
+using std::cerr;
+
+#include <fstream>
+using std::ifstream;
+
+#include <stdexcept>
+using std::invalid_argument;
+
+#include <memory>
+using std::unique_ptr;
+using std::make_unique;
+using std::shared_ptr;
+using std::make_shared;
+
+#include <algorithm>
+using std::min;
+using std::max;
+
+#include <chrono>
+using std::chrono::steady_clock;
+using std::chrono::duration_cast;
+using std::chrono::microseconds;
+
+using std::future;
+
+#include <optional>
+
+#include <filesystem>
+using std::filesystem::path;
+
+#include <system_error>
+using std::error_code;
+
+#include <mutex>
+using std::mutex;
+using std::lock_guard;
+
+#include <cassert>
+
+
+// The albedo is only calculated if there is memory for it.
+double* albedoPointer(vector<double>& albedoData) {
+	return albedoData.empty() ? nullptr : &albedoData[0];
+}
+
+
+// Decodes a band and solves its tiles into out, each as soon as its
+// rows are there for all lights. Decoding and solving share the pool,
+// so they overlap, also with whatever else is running on the pool.
+// Starts right away, finish waits until all is done. The rows are also
+// handed on to onRowsReady, unless it is null.
+template<typename Sample>
+class BandSolve {
+public:
+	BandSolve(
+		DatasetReader<Sample>& reader,
+		LightStack<Sample>& band,
+		const Solver<Sample>& solver,
+		double* out,
+		double* albedo,
+		ThreadPool& pool,
+		const unsigned int nWorkers,
+		const typename DatasetReader<Sample>::RowsReady& onRowsReady = nullptr)
+		:
+		scheduler(band.width, band.height, false)
+	{
+		decoders = reader.startReadingBand(band, pool, [this, onRowsReady](const size_t begin, const size_t end) {
+			scheduler.publishRows(begin, end);
+			if (onRowsReady) {
+				onRowsReady(begin, end);
+			}
+		});
+
+		// Enqueued after the decoders, so a worker waiting for rows
+		// never holds up a decoder that is still in the queue.
+		workers.reserve(nWorkers);
+		for (unsigned int i = 0; i < nWorkers; ++i) {
+			workers.push_back(pool.enqueue([this, &solver, &band, out, albedo] {
+				solver.work(band, scheduler, out, albedo);
+			}));
+		}
+	}
+
+	BandSolve(const BandSolve&) = delete;
+	BandSolve& operator=(const BandSolve&) = delete;
+
+	// The tasks use this object and the band.
+	~BandSolve() {
+		scheduler.cancel();
+		waitFor(decoders);
+		waitFor(workers);
+	}
+
+
+	void finish() {
+		try {
+			waitAll(decoders);
+		}
+		catch (...) {
+			// The rows will never come, but the workers still use the band.
+			scheduler.cancel();
+			waitFor(workers);
+			throw;
+		}
+
+		waitAll(workers);
+	}
+
+private:
+	TileScheduler scheduler;
+	vector<future<void>> decoders;
+	vector<future<void>> workers;
+};
+
+
+template<typename Sample>
+void readAndSolve(
+	DatasetReader<Sample>& reader,
+	LightStack<Sample>& band,
+	const Solver<Sample>& solver,
+	double* out,
+	double* albedo,
+	ThreadPool& pool,
+	const unsigned int nWorkers,
+	const typename DatasetReader<Sample>::RowsReady& onRowsReady = nullptr)
+{
+	BandSolve<Sample>{ reader, band, solver, out, albedo, pool, nWorkers, onRowsReady }.finish();
+}
+
+
+// A preview has no edge longer than this, so
+// it is solved and written within milliseconds.
+const size_t PREVIEW_SIZE = 256;
+
+// A preview is written whenever this part of its rows is new.
+const size_t PREVIEW_STEPS = 8;
+
+
+// Replaces the preview through a temporary file, so whoever
+// is watching it never gets to see half of one.
+void writePreview(const NormalMapView& normalMap, const string& file) {
+	path partial{ file };
+	partial.replace_filename(partial.stem().string() + ".partial" + partial.extension().string());
+	NormalMapWriter writer{ partial.string(), normalMap.width, normalMap.height };
+	writer.write(normalMap, 0);
+	writer.close();
+
+	error_code error;
+	std::filesystem::rename(partial, file, error);
+	if (error) throw invalid_argument{ "Cannot write file: " + file };
+}
+
+
+// Writes previews of a dataset while it is decoded. The rows of the
+// dataset are taken as they arrive, every step-th of them and of
+// their columns, and solved as a band of the preview at once, so the
+// preview fills from top to bottom, rows still missing are flat. It
+// runs alongside the solve of the dataset and doesn't hold it up.
+template<typename Sample>
+class StreamedPreview {
+public:
+	StreamedPreview(
+		const LightStack<Sample>& dataset,
+		const RunOptions& options,
+		BackgroundWriter& background,
+		const steady_clock::time_point begin)
+		:
+		dataset(dataset),
+		options(options),
+		background(background),
+		begin(begin),
+		step((max(dataset.width, dataset.height) + PREVIEW_SIZE - 1) / PREVIEW_SIZE),
+		width((dataset.width + step - 1) / step),
+		height((dataset.height + step - 1) / step),
+		solver(dataset.lightDirections, width, height, options.correctionRadians, options.precision, options.isa, options.rejection),
+		normalsData(width * height * 3, 0.0)
+	{
+		assert(dataset.firstRow == 0);
+		for (size_t i = 2; i < normalsData.size(); i += 3) {
+			normalsData[i] = 1.0;
+		}
+	}
+
+
+	// Writes a preview from the largest mip-map level of the files
+	// first, if they have one, see DatasetReader::readReduced. Then
+	// only finer previews follow. Before the dataset is read.
+	void showReduced(DatasetReader<Sample>& reader, ThreadPool& pool, const unsigned int nWorkers) {
+		const std::optional<LightStack<Sample>> reduced = reader.readReduced(PREVIEW_SIZE);
+		if (!reduced) return;
+
+		const auto normalMap = make_shared<const NormalMap>(photometricStereo(
+			*reduced, options.correctionRadians, pool, nWorkers, options.precision, options.isa, options.rejection));
+		post(normalMap, reduced->height);
+		finished = reduced->width >= width;
+	}
+
+
+	// Takes the rows [rowsBegin, rowsEnd) of the dataset, which have
+	// to be there for all lights. Can be called from any thread.
+	void addRows(const size_t rowsBegin, const size_t rowsEnd) {
+		if (finished) return;
+
+		const size_t yBegin = (rowsBegin + step - 1) / step;
+		const size_t yEnd = min((rowsEnd + step - 1) / step, height);
+		if (yBegin >= yEnd) return;
+
+		vector<double> rows(width * (yEnd - yBegin) * 3);
+		{
+			const TraceSpan span{ "preview" };
+			LightStack<Sample> band{ width, yEnd - yBegin, dataset.nLights, yBegin };
+			band.lightDirections = dataset.lightDirections;
+
+			vector<Sample> row(width);
+			for (size_t y = yBegin; y < yEnd; ++y) {
+				for (size_t k = 0; k < band.nLights; ++k) {
+					for (size_t x = 0; x < width; ++x) {
+						row[x] = dataset.at(x * step, y * step, k);
+					}
+					band.setRow(k, y - yBegin, &row[0]);
+				}
+			}
+			solver.solveTile(band, Tile{ 0, width, 0, band.height }, &rows[0]);
+		}
+
+		// Posted under the lock, so the previews are written in order.
+		const lock_guard<mutex> lock{ previewMutex };
+		std::copy(rows.begin(), rows.end(), normalsData.begin() + yBegin * width * 3);
+		rowsDone += yEnd - yBegin;
+
+		if (rowsDone == height || (rowsDone - rowsWritten) * PREVIEW_STEPS >= height) {
+			rowsWritten = rowsDone;
+			post(make_shared<const NormalMap>(width, height, normalsData), rowsDone);
+		}
+	}
+
+private:
+	const LightStack<Sample>& dataset;
+	const RunOptions& options;
+	BackgroundWriter& background;
+	const steady_clock::time_point begin;
+
+	// Every step-th row and column of the dataset is in the preview.
+	const size_t step;
+	const size_t width;
+	const size_t height;
+	const Solver<Sample> solver;
+
+	// True if the files gave a preview as fine as this one.
+	bool finished = false;
+
+	mutex previewMutex;
+	vector<double> normalsData;
+	size_t rowsDone = 0;
+	size_t rowsWritten = 0;
+
+
+	// The write doesn't use this, which can be gone by then.
+	void post(const shared_ptr<const NormalMap>& normalMap, const size_t rows) {
+		background.post([normalMap, rows, &options = options, begin = begin] {
+			writePreview(*normalMap, options.outPreviewMap);
+			const steady_clock::time_point end = steady_clock::now();
+			cout << "Preview " << normalMap->width << 'x' << normalMap->height << " with " << rows << " rows after (sec) = "
+				<< (duration_cast<microseconds>(end - begin).count()) / 1000000.0 << '\n';
+		});
+	}
+};
+
+
+// Writes the maps of a whole dataset in the background while the
+// heights are integrated and returns when all is written.
+void writeWhole(
+	const RunOptions& options,
+	NormalMapWriter& writer,
+	std::optional<AlbedoMapWriter>& albedoWriter,
+	const shared_ptr<const NormalMap>& normalMap,
+	const shared_ptr<const AlbedoMap>& albedoMap,
+	ThreadPool& pool,
+	const unsigned int parallelism,
+	BackgroundWriter& background)
+{
+	background.post([&writer, normalMap] {
+		cout << "Writing image.\n";
+		writer.write(*normalMap, 0);
+		writer.close();
+	});
+	if (albedoWriter) {
+		background.post([&albedoWriter, albedoMap] {
+			cout << "Writing albedo.\n";
+			albedoWriter->write(*albedoMap, 0);
+			albedoWriter->close();
+		});
+	}
+
+	if (!options.outHeightMap.empty()) {
+		const steady_clock::time_point begin = steady_clock::now();
+		const auto heightMap = make_shared<const HeightMap>(integrateNormals(*normalMap, pool, parallelism - 1));
+		const steady_clock::time_point end = steady_clock::now();
+		cout << "Integration Time Heightmap (sec) = " << (duration_cast<microseconds>(end - begin).count()) / 1000000.0 << std::endl;
+
+		background.post([heightMap, &options] {
+			writeHeightMap(*heightMap, options.outHeightMap);
+		});
+	}
+
+	background.finish();
+}
+
+
+template<typename Sample>
+void runWhole(const RunOptions& options) {
+	const unsigned int parallelism = std::thread::hardware_concurrency();
+	assert(parallelism > 0);
+	ThreadPool pool{ parallelism };
+
+	cout << "Reading and calculating ... (" << parallelism << " threads)\n";
+
+	steady_clock::time_point begin = steady_clock::now();
+
+	// The signature is taken before reading, see storeCachedDataset.
+	const bool caching = !options.cacheDirectory.empty();
+	const string signature = caching ? datasetSignature(options.datasetDirectory) : string{};
+	std::optional<LightStack<Sample>> dataset = caching
+		? loadCachedDataset<Sample>(options.cacheDirectory, options.datasetDirectory, signature)
+		: std::nullopt;
+	const bool cached = dataset.has_value();
+
+	unique_ptr<DatasetReader<Sample>> reader;
+	if (!cached) {
+		reader = make_unique<DatasetReader<Sample>>(options.datasetDirectory);
+		dataset.emplace(reader->makeBand(0, reader->height));
+	}
+	const size_t width = dataset->width;
+	const size_t height = dataset->height;
+
+	const Solver<Sample> solver{
+		dataset->lightDirections, width, height, options.correctionRadians, options.precision, options.isa, options.rejection };
+
+	// Opened up front, so a wrong file or format fails before all the work.
+	NormalMapWriter writer{ options.outNormalMap, width, height, options.output };
+	std::optional<AlbedoMapWriter> albedoWriter;
+	if (!options.outAlbedoMap.empty()) {
+		albedoWriter.emplace(options.outAlbedoMap, width, height);
+	}
+
+	vector<double> normalsData(width * height * 3);
+	vector<double> albedoData(options.outAlbedoMap.empty() ? 0 : width * height);
+
+	// The previews, the maps and the cache are written
+	// while the heights are integrated.
+	BackgroundWriter background;
+
+	if (cached) {
+		cout << "Samples from the cache.\n";
+	}
+
+	// The preview is filled in by the rows the solve gets.
+	std::optional<StreamedPreview<Sample>> preview;
+	typename DatasetReader<Sample>::RowsReady onRowsReady;
+	if (!options.outPreviewMap.empty()) {
+		preview.emplace(*dataset, options, background, begin);
+		onRowsReady = [&preview](const size_t rowsBegin, const size_t rowsEnd) {
+			preview->addRows(rowsBegin, rowsEnd);
+		};
+	}
+
+	if (cached) {
+		if (preview) {
+			preview->addRows(0, height);
+		}
+		solver.solve(*dataset, &normalsData[0], pool, parallelism - 1, albedoPointer(albedoData));
+	}
+	else {
+		if (preview) {
+			preview->showReduced(*reader, pool, parallelism - 1);
+		}
+		readAndSolve(*reader, *dataset, solver, &normalsData[0], albedoPointer(albedoData), pool, parallelism, onRowsReady);
+	}
+
+	steady_clock::time_point end = steady_clock::now();
+	cout << "Reading and Calculation Time Normalmap (sec) = " << (duration_cast<microseconds>(end - begin).count()) / 1000000.0 << std::endl;
+
+	if (caching && !cached) {
+		background.post([&dataset, &options, &signature] {
+			try {
+				storeCachedDataset(*dataset, options.cacheDirectory, options.datasetDirectory, signature);
+			}
+			catch (invalid_argument e) {
+				// Only the next run is slower.
+				cerr << "No cache: " << e.what() << '\n';
+			}
+		});
+	}
+
+	writeWhole(
+		options,
+		writer,
+		albedoWriter,
+		make_shared<const NormalMap>(width, height, std::move(normalsData)),
+		albedoWriter ? make_shared<const AlbedoMap>(width, height, std::move(albedoData)) : nullptr,
+		pool,
+		parallelism,
+		background);
+}
+
+
+// Colored photometric stereo: the red, green and blue samples are solved
+// on their own, with the same solver, and combined, see combineChannels.
+// The albedo-map gets all three channels.
+template<typename Sample>
+void runColor(const RunOptions& options) {
+	const unsigned int parallelism = std::thread::hardware_concurrency();
+	assert(parallelism > 0);
+	ThreadPool pool{ parallelism };
+
+	cout << "Reading and calculating per channel ... (" << parallelism << " threads)\n";
+
+	const steady_clock::time_point begin = steady_clock::now();
+
+	DatasetReader<Sample> reader{ options.datasetDirectory };
+	const size_t width = reader.width;
+	const size_t height = reader.height;
+	const size_t nPixels = width * height;
+
+	const Solver<Sample> solver{
+		reader.lightDirections, width, height, options.correctionRadians, options.precision, options.isa, options.rejection };
+
+	NormalMapWriter writer{ options.outNormalMap, width, height, options.output };
+	std::optional<AlbedoMapWriter> albedoWriter;
+	if (!options.outAlbedoMap.empty()) {
+		albedoWriter.emplace(options.outAlbedoMap, width, height, 3);
+	}
+
+	vector<double> channelNormals[3];
+	vector<double> channelAlbedo[3];
+	{
+		vector<LightStack<Sample>> channels;
+		for (size_t c = 0; c < 3; ++c) {
+			channels.push_back(reader.makeBand(0, height));
+		}
+		reader.readChannels(channels, pool);
+
+		for (size_t c = 0; c < 3; ++c) {
+			channelNormals[c].resize(nPixels * 3);
+			channelAlbedo[c].resize(nPixels);
+			solver.solve(channels[c], &channelNormals[c][0], pool, parallelism - 1, &channelAlbedo[c][0]);
+		}
+	}
+
+	vector<double> normalsData(nPixels * 3);
+	vector<double> albedoData(albedoWriter ? nPixels * 3 : 0);
+	const double* normals[3] = { &channelNormals[0][0], &channelNormals[1][0], &channelNormals[2][0] };
+	const double* albedo[3] = { &channelAlbedo[0][0], &channelAlbedo[1][0], &channelAlbedo[2][0] };
+	combineChannels(normals, albedo, nPixels, &normalsData[0], albedoPointer(albedoData));
+
+	const steady_clock::time_point end = steady_clock::now();
+	cout << "Reading and Calculation Time Normalmap (sec) = " << (duration_cast<microseconds>(end - begin).count()) / 1000000.0 << std::endl;
+
+	BackgroundWriter background;
+	writeWhole(
+		options,
+		writer,
+		albedoWriter,
+		make_shared<const NormalMap>(width, height, std::move(normalsData)),
+		albedoWriter ? make_shared<const AlbedoMap>(width, height, std::move(albedoData), 3) : nullptr,
+		pool,
+		parallelism,
+		background);
+}
+
+
+// Adds one image after another to an Accumulator, the next image is
+// decoded meanwhile. Only two images and the sums are ever in memory,
+// and after the last image only the normals are left to calculate.
+template<typename Sample>
+void runIncremental(const RunOptions& options) {
+	const unsigned int parallelism = std::thread::hardware_concurrency();
+	assert(parallelism > 0);
+	ThreadPool pool{ parallelism };
+
+	const vector<string> files = listItems(options.datasetDirectory);
+	if (files.size() < DatasetReader<Sample>::MIN_LIGHTS || DatasetReader<Sample>::MAX_LIGHTS < files.size()) {
+		throw invalid_argument{ "Expected " + std::to_string(DatasetReader<Sample>::MIN_LIGHTS) + " to "
+			+ std::to_string(DatasetReader<Sample>::MAX_LIGHTS) + " images, found "
+			+ std::to_string(files.size()) + " in: " + options.datasetDirectory };
+	}
+	for (const string& file : files) {
+		if (parseExposure(file) != parseExposure(files[0])) {
+			throw invalid_argument{ "Exposure brackets need all images of a lamp at once, not incremental mode." };
+		}
+	}
+
+	cout << "Adding one image after another ... (" << parallelism << " threads)\n";
+
+	const steady_clock::time_point begin = steady_clock::now();
+
+	ReflectionMap<Sample> map = readIntensities<Sample>(files[0]);
+	const size_t width = map.width;
+	const size_t height = map.height;
+
+	NormalMapWriter writer{ options.outNormalMap, width, height, options.output };
+	std::optional<AlbedoMapWriter> albedoWriter;
+	if (!options.outAlbedoMap.empty()) {
+		albedoWriter.emplace(options.outAlbedoMap, width, height);
+	}
+
+	Accumulator accumulator{ width, height, options.correctionRadians };
+	for (size_t k = 1; k <= files.size(); ++k) {
+		future<ReflectionMap<Sample>> next;
+		if (k < files.size()) {
+			next = std::async(std::launch::async, readIntensities<Sample>, files[k]);
+		}
+
+		accumulator.add(map, pool, parallelism - 1);
+
+		if (next.valid()) {
+			map = next.get();
+		}
+	}
+
+	const steady_clock::time_point added = steady_clock::now();
+
+	vector<double> normalsData(width * height * 3);
+	vector<double> albedoData(albedoWriter ? width * height : 0);
+	accumulator.finish(&normalsData[0], pool, parallelism - 1, albedoPointer(albedoData));
+
+	const steady_clock::time_point end = steady_clock::now();
+	cout << "Reading and Calculation Time Normalmap (sec) = " << (duration_cast<microseconds>(end - begin).count()) / 1000000.0 << std::endl;
+	cout << "After the last image (sec) = " << (duration_cast<microseconds>(end - added).count()) / 1000000.0 << std::endl;
+
+	BackgroundWriter background;
+	writeWhole(
+		options,
+		writer,
+		albedoWriter,
+		make_shared<const NormalMap>(width, height, std::move(normalsData)),
+		albedoWriter ? make_shared<const AlbedoMap>(width, height, std::move(albedoData)) : nullptr,
+		pool,
+		parallelism,
+		background);
+}
+
+
+// Reads, solves and writes one band after another.
+template<typename Sample>
+void runStreaming(const RunOptions& options) {
+	DatasetReader<Sample> reader{ options.datasetDirectory };
+	const size_t width = reader.width;
+	const size_t height = reader.height;
+
+	const Solver<Sample> solver{
+		reader.lightDirections, width, height, options.correctionRadians, options.precision, options.isa, options.rejection };
+	NormalMapWriter writer{ options.outNormalMap, width, height, options.output };
+	std::optional<AlbedoMapWriter> albedoWriter;
+	if (!options.outAlbedoMap.empty()) {
+		albedoWriter.emplace(options.outAlbedoMap, width, height);
+	}
+
+	// Bands are encoded while the next ones are calculated.
+	BackgroundWriter background;
+
+	const unsigned int parallelism = std::thread::hardware_concurrency();
+	assert(parallelism > 0);
+	ThreadPool pool{ parallelism };
+
+	cout << "Streaming in bands of " << options.bandRows << " rows ... (" << parallelism << " threads)\n";
+
+	steady_clock::time_point begin = steady_clock::now();
+
+	// Reused from band to band.
+	vector<Sample> samples;
+
+	for (size_t firstRow = 0; firstRow < height; firstRow += options.bandRows) {
+		const size_t nRows = min(options.bandRows, height - firstRow);
+
+		LightStack<Sample> band = reader.makeBand(firstRow, nRows, std::move(samples));
+
+		// Handed over to the writer as they are.
+		vector<double> normalsData(width * nRows * 3);
+		vector<double> albedoData(albedoWriter ? width * nRows : 0);
+		readAndSolve(reader, band, solver, &normalsData[0], albedoPointer(albedoData), pool, parallelism);
+		samples = std::move(band.samples);
+
+		const auto normals = make_shared<const NormalMap>(width, nRows, std::move(normalsData));
+		const auto albedo = albedoWriter ? make_shared<const AlbedoMap>(width, nRows, std::move(albedoData)) : nullptr;
+		background.post([&writer, &albedoWriter, normals, albedo, firstRow] {
+			writer.write(*normals, firstRow);
+			if (albedo) {
+				albedoWriter->write(*albedo, firstRow);
+			}
+		});
+	}
+	background.finish();
+	writer.close();
+	if (albedoWriter) {
+		albedoWriter->close();
+	}
+
+	steady_clock::time_point end = steady_clock::now();
+	cout << "Total Time (sec) = " << (duration_cast<microseconds>(end - begin).count()) / 1000000.0 << std::endl;
+}
+
+
+// Band size of a sweep if no other is given, the dataset
+// doesn't need to be in memory for it.
+const size_t SWEEP_BAND_ROWS = 256;
+
+
+// Solves bands without correction and writes every angle of the sweep
+// from them. Each angle is corrected and encoded in its own task,
+// while the next band is decoded and solved.
+template<typename Sample>
+void runSweep(const RunOptions& options) {
+	DatasetReader<Sample> reader{ options.datasetDirectory };
+	const size_t width = reader.width;
+	const size_t height = reader.height;
+	const size_t bandRows = options.bandRows > 0 ? options.bandRows : SWEEP_BAND_ROWS;
+
+	// The normals stay unnormalized, so every angle is corrected and
+	// normalized in the same precision as by a single run.
+	const Solver<Sample> solver{
+		reader.lightDirections, width, height, 0.0, options.precision, options.isa, options.rejection, false };
+
+	// Only their correction is used, so they need no rejection.
+	vector<unique_ptr<const Solver<Sample>>> corrections;
+	vector<unique_ptr<NormalMapWriter>> writers;
+	for (const int degrees : options.sweepDegrees) {
+		corrections.push_back(make_unique<const Solver<Sample>>(
+			reader.lightDirections, width, height, degreesToRadians(degrees), options.precision, options.isa));
+		writers.push_back(make_unique<NormalMapWriter>(sweepFile(options.outNormalMap, degrees), width, height, options.output));
+	}
+	std::optional<AlbedoMapWriter> albedoWriter;
+	if (!options.outAlbedoMap.empty()) {
+		albedoWriter.emplace(options.outAlbedoMap, width, height);
+	}
+
+	const unsigned int parallelism = std::thread::hardware_concurrency();
+	assert(parallelism > 0);
+	ThreadPool pool{ parallelism };
+
+	cout << "Sweeping " << corrections.size() << " corrections in bands of " << bandRows << " rows ... ("
+		<< parallelism << " threads)\n";
+
+	steady_clock::time_point begin = steady_clock::now();
+
+	// One band is solved into the one buffer while the
+	// tasks of the band before still read the other.
+	vector<Sample> samples;
+	vector<double> uncorrected[2];
+	vector<double> albedoData[2];
+	vector<future<void>> encoders;
+
+	try {
+		for (size_t firstRow = 0, i = 0; firstRow < height; firstRow += bandRows, ++i) {
+			const size_t nRows = min(bandRows, height - firstRow);
+			vector<double>& normalsData = uncorrected[i % 2];
+			vector<double>& albedo = albedoData[i % 2];
+
+			LightStack<Sample> band = reader.makeBand(firstRow, nRows, std::move(samples));
+
+			normalsData.resize(width * nRows * 3);
+			albedo.resize(albedoWriter ? width * nRows : 0);
+			readAndSolve(reader, band, solver, &normalsData[0], albedoPointer(albedo), pool, parallelism);
+			samples = std::move(band.samples);
+
+			// The rows have to reach each writer in order.
+			waitAll(encoders);
+			encoders.clear();
+
+			for (size_t a = 0; a < corrections.size(); ++a) {
+				encoders.push_back(pool.enqueue([&corrections, &writers, &normalsData, a, firstRow, nRows, width] {
+					vector<double> corrected(normalsData.size());
+					{
+						const TraceSpan span{ "correct" };
+						corrections[a]->correct(&normalsData[0], &corrected[0], firstRow, nRows);
+					}
+					writers[a]->write(NormalMapView{ width, nRows, corrected }, firstRow);
+				}));
+			}
+			if (albedoWriter) {
+				encoders.push_back(pool.enqueue([&albedoWriter, &albedo, firstRow, nRows, width] {
+					albedoWriter->write(AlbedoMapView{ width, nRows, albedo }, firstRow);
+				}));
+			}
+		}
+		waitAll(encoders);
+	}
+	catch (...) {
+		// The tasks use the buffers.
+		waitFor(encoders);
+		throw;
+	}
+
+	cout << "Writing images.\n";
+	for (unique_ptr<NormalMapWriter>& writer : writers) {
+		writer->close();
+	}
+	if (albedoWriter) {
+		albedoWriter->close();
+	}
+
+	steady_clock::time_point end = steady_clock::now();
+	cout << "Total Time (sec) = " << (duration_cast<microseconds>(end - begin).count()) / 1000000.0 << std::endl;
+}
+
+
+// A dataset of a batch on its way through the pipeline. The memory
+// of a slot is reused for the dataset after the next one.
+template<typename Sample>
+struct BatchSlot {
+	const BatchJob* job = nullptr;
+	unique_ptr<DatasetReader<Sample>> reader;
+	unique_ptr<const Solver<Sample>> solver;
+	unique_ptr<LightStack<Sample>> band;
+	unique_ptr<BandSolve<Sample>> solve;
+	vector<Sample> samples;
+	vector<double> normalsData;
+	vector<double> albedoData;
+	future<void> write;
+};
+
+
+// Runs the jobs so that while one dataset is decoded and solved, the
+// one before is written. The next dataset starts decoding on the
+// threads the solve of the current one doesn't need anymore. A job
+// that fails is reported and the batch goes on.
+template<typename Sample>
+size_t runBatchWithSamples(const vector<BatchJob>& jobs, const RunOptions& options) {
+	const unsigned int parallelism = std::thread::hardware_concurrency();
+	assert(parallelism > 0);
+	ThreadPool pool{ parallelism };
+
+	cout << "Batch of " << jobs.size() << " datasets ... (" << parallelism << " threads)\n";
+
+	steady_clock::time_point begin = steady_clock::now();
+
+	size_t failed = 0;
+	const auto report = [&failed](const BatchJob& job, const invalid_argument& e) {
+		cerr << job.datasetDirectory << ": " << e.what() << '\n';
+		++failed;
+	};
+
+	const auto start = [&](BatchSlot<Sample>& slot, const BatchJob& job) {
+		slot.job = &job;
+		try {
+			slot.reader = make_unique<DatasetReader<Sample>>(job.datasetDirectory);
+			const size_t width = slot.reader->width;
+			const size_t height = slot.reader->height;
+
+			slot.solver = make_unique<const Solver<Sample>>(
+				slot.reader->lightDirections, width, height, job.correctionRadians, options.precision, options.isa, options.rejection);
+			slot.band = make_unique<LightStack<Sample>>(slot.reader->makeBand(0, height, std::move(slot.samples)));
+			slot.normalsData.resize(width * height * 3);
+			slot.albedoData.resize(job.outAlbedoMap.empty() ? 0 : width * height);
+
+			slot.solve = make_unique<BandSolve<Sample>>(
+				*slot.reader, *slot.band, *slot.solver, &slot.normalsData[0], albedoPointer(slot.albedoData), pool, parallelism);
+		}
+		catch (invalid_argument e) {
+			report(job, e);
+		}
+	};
+
+	const auto finishSolve = [&](BatchSlot<Sample>& slot) {
+		if (!slot.solve) return;
+
+		bool solved = true;
+		try {
+			slot.solve->finish();
+		}
+		catch (invalid_argument e) {
+			report(*slot.job, e);
+			solved = false;
+		}
+		slot.solve.reset();
+
+		const size_t width = slot.band->width;
+		const size_t height = slot.band->height;
+		slot.samples = std::move(slot.band->samples);
+		slot.band.reset();
+		slot.reader.reset();
+
+		if (solved) {
+			// The integration shares the pool with the next dataset.
+			slot.write = std::async(std::launch::async, [&slot, &pool, &options, parallelism, width, height] {
+				const NormalMapView normalMap{ width, height, slot.normalsData };
+				writeNormalMap(normalMap, slot.job->outNormalMap, options.output);
+				if (!slot.job->outAlbedoMap.empty()) {
+					writeAlbedoMap(AlbedoMapView{ width, height, slot.albedoData }, slot.job->outAlbedoMap);
+				}
+				if (!slot.job->outHeightMap.empty()) {
+					writeHeightMap(integrateNormals(normalMap, pool, parallelism - 1), slot.job->outHeightMap);
+				}
+			});
+		}
+	};
+
+	const auto finishWrite = [&](BatchSlot<Sample>& slot) {
+		if (!slot.write.valid()) return;
+
+		try {
+			slot.write.get();
+		}
+		catch (invalid_argument e) {
+			report(*slot.job, e);
+		}
+	};
+
+	BatchSlot<Sample> slots[2];
+
+	for (size_t i = 0; i <= jobs.size(); ++i) {
+		BatchSlot<Sample>& current = slots[i % 2];
+		BatchSlot<Sample>& previous = slots[(i + 1) % 2];
+
+		if (i < jobs.size()) {
+			cout << "Dataset " << (i + 1) << " of " << jobs.size() << ": " << jobs[i].datasetDirectory << '\n';
+
+			// The memory of the slot is still being written.
+			finishWrite(current);
+			start(current, jobs[i]);
+		}
+		if (i > 0) {
+			finishSolve(previous);
+		}
+	}
+	finishWrite(slots[0]);
+	finishWrite(slots[1]);
+
+	steady_clock::time_point end = steady_clock::now();
+	cout << "Total Time (sec) = " << (duration_cast<microseconds>(end - begin).count()) / 1000000.0 << std::endl;
+
+	return failed;
+}
+
+
+bool sameDirections(const vector<Vec3>& a, const vector<Vec3>& b) {
+	if (a.size() != b.size()) return false;
+	for (size_t k = 0; k < a.size(); ++k) {
+		if (a[k].data != b[k].data) return false;
+	}
+	return true;
+}
+
+
+template<typename Sample>
+Session<Sample>::Session(const RunOptions& options)
+	:
+	options(options),
+	parallelism(max(1u, std::thread::hardware_concurrency())),
+	pool(parallelism)
+{}
+
+
+template<typename Sample>
+JobTimes Session<Sample>::run(const BatchJob& job, const OutputFormat& output) {
+	const steady_clock::time_point begin = steady_clock::now();
+
+	DatasetReader<Sample> reader{ job.datasetDirectory };
+	const size_t width = reader.width;
+	const size_t height = reader.height;
+
+	if (!solver || width != solverWidth || height != solverHeight || job.correctionRadians != solverCorrection ||
+		!sameDirections(reader.lightDirections, solverDirections)) {
+		solver = make_unique<const Solver<Sample>>(
+			reader.lightDirections, width, height, job.correctionRadians, options.precision, options.isa, options.rejection);
+		solverDirections = reader.lightDirections;
+		solverWidth = width;
+		solverHeight = height;
+		solverCorrection = job.correctionRadians;
+	}
+
+	// Opened up front, so a wrong file or format fails before all the work.
+	NormalMapWriter writer{ job.outNormalMap, width, height, output };
+	std::optional<AlbedoMapWriter> albedoWriter;
+	if (!job.outAlbedoMap.empty()) {
+		albedoWriter.emplace(job.outAlbedoMap, width, height);
+	}
+
+	LightStack<Sample> band = reader.makeBand(0, height, std::move(samples));
+	normalsData.resize(width * height * 3);
+	albedoData.resize(albedoWriter ? width * height : 0);
+	try {
+		readAndSolve(reader, band, *solver, &normalsData[0], albedoPointer(albedoData), pool, parallelism);
+	}
+	catch (...) {
+		samples = std::move(band.samples);
+		throw;
+	}
+	samples = std::move(band.samples);
+
+	const steady_clock::time_point solved = steady_clock::now();
+
+	// Like writeWhole, but on the memory that stays for the next job.
+	const NormalMapView normalMap{ width, height, normalsData };
+	BackgroundWriter background;
+	background.post([&writer, normalMap] {
+		writer.write(normalMap, 0);
+		writer.close();
+	});
+	if (albedoWriter) {
+		background.post([&albedoWriter, albedoMap = AlbedoMapView{ width, height, albedoData }] {
+			albedoWriter->write(albedoMap, 0);
+			albedoWriter->close();
+		});
+	}
+	if (!job.outHeightMap.empty()) {
+		const auto heightMap = make_shared<const HeightMap>(integrateNormals(normalMap, pool, parallelism - 1));
+		background.post([heightMap, &job] {
+			writeHeightMap(*heightMap, job.outHeightMap);
+		});
+	}
+	background.finish();
+
+	const steady_clock::time_point end = steady_clock::now();
+	const auto seconds = [](const steady_clock::duration d) {
+		return duration_cast<microseconds>(d).count() / 1000000.0;
+	};
+	return { seconds(solved - begin), seconds(end - solved), seconds(end - begin) };
+}
+
+
+template class Session<uint8_t>;
+template class Session<uint16_t>;
+template class Session<Half>;
+template class Session<float>;
+
+
+template<typename Sample>
+void runWithSamples(const RunOptions& options) {
+	if (!options.outPreviewMap.empty() && (options.bandRows > 0 || !options.sweepDegrees.empty())) {
+		throw invalid_argument{ "The preview needs the whole dataset, it cannot be used with bands or a sweep." };
+	}
+
+	if (options.incremental) {
+		checkJobOptions(options, "incremental mode");
+		if (options.rejection.enabled) {
+			throw invalid_argument{ "Shadows and highlights need all images of a pixel, they cannot be rejected incrementally." };
+		}
+
+		runIncremental<Sample>(options);
+	}
+	else if (options.color) {
+		if (options.bandRows > 0 || !options.sweepDegrees.empty() || !options.outPreviewMap.empty() || !options.cacheDirectory.empty()) {
+			throw invalid_argument{ "Color is only supported for whole datasets, without bands, sweep, preview or cache." };
+		}
+
+		runColor<Sample>(options);
+	}
+	else if (!options.sweepDegrees.empty()) {
+		if (!options.cacheDirectory.empty()) {
+			throw invalid_argument{ "The cache holds whole datasets, it cannot be used with a sweep." };
+		}
+		if (!options.outHeightMap.empty()) {
+			throw invalid_argument{ "A sweep writes no height-map, integrate the normal-map of one correction." };
+		}
+
+		runSweep<Sample>(options);
+	}
+	else if (options.bandRows > 0) {
+		if (!options.cacheDirectory.empty()) {
+			throw invalid_argument{ "The cache holds whole datasets, it cannot be used with bands." };
+		}
+		if (!options.outHeightMap.empty()) {
+			throw invalid_argument{ "The height-map needs the whole normal-map, it cannot be streamed in bands." };
+		}
+
+		runStreaming<Sample>(options);
+	}
+	else {
+		runWhole<Sample>(options);
+	}
+}
+
+
+void run(const RunOptions& options) {
+	switch (options.sampleFormat) {
+	case SampleFormat::UInt8: return runWithSamples<uint8_t>(options);
+	case SampleFormat::Half: return runWithSamples<Half>(options);
+	case SampleFormat::Float: return runWithSamples<float>(options);
+	default: return runWithSamples<uint16_t>(options);
+	}
+}
+
+
+string sweepFile(const string& outNormalMap, const int degrees) {
+	path file{ outNormalMap };
+	file.replace_filename(file.stem().string() + "_" + std::to_string(degrees) + file.extension().string());
+	return file.string();
+}
+
+
+BatchJob parseJob(const string& line) {
+	const vector<string> fields = splitBy(line, ';');
+	if (fields.size() < 3 || fields.size() > 5) {
+		throw invalid_argument{ "Line expected in the form \"dataset;result;correction[;albedo[;height]]\": " + line };
+	}
+
+	BatchJob job;
+	job.datasetDirectory = fields[0];
+	job.outNormalMap = fields[1];
+	job.correctionRadians = degreesToRadians(stoi(fields[2]));
+	if (fields.size() >= 4) {
+		job.outAlbedoMap = fields[3];
+	}
+	if (fields.size() == 5) {
+		job.outHeightMap = fields[4];
+	}
+	return job;
+}
+
+
+vector<BatchJob> readManifest(const string& file) {
+	ifstream in{ file };
+	if (!in) throw invalid_argument{ "Cannot open file: " + file };
+
+	vector<BatchJob> jobs;
+	string line;
+	while (getline(in, line)) {
+		if (!line.empty() && line.back() == '\r') line.pop_back();
+		if (line.empty() || line[0] == '#') continue;
+
+		jobs.push_back(parseJob(line));
+	}
+	return jobs;
+}
+
+
+void checkJobOptions(const RunOptions& options, const string& mode) {
+	if (options.bandRows > 0) {
+		throw invalid_argument{ "Bands are not supported in " + mode + "." };
+	}
+	if (!options.cacheDirectory.empty()) {
+		throw invalid_argument{ "The cache is not supported in " + mode + "." };
+	}
+	if (!options.sweepDegrees.empty()) {
+		throw invalid_argument{ "A sweep is not supported in " + mode + "." };
+	}
+	if (!options.outPreviewMap.empty()) {
+		throw invalid_argument{ "The preview is not supported in " + mode + "." };
+	}
+	if (options.color) {
+		throw invalid_argument{ "Color is not supported in " + mode + "." };
+	}
+}
+
+
+size_t runBatch(const vector<BatchJob>& jobs, const RunOptions& options) {
+	checkJobOptions(options, "batch mode");
+
+	switch (options.sampleFormat) {
+	case SampleFormat::UInt8: return runBatchWithSamples<uint8_t>(jobs, options);
+	case SampleFormat::Half: return runBatchWithSamples<Half>(jobs, options);
+	case SampleFormat::Float: return runBatchWithSamples<float>(jobs, options);
+	default: return runBatchWithSamples<uint16_t>(jobs, options);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,145 @@
+#pragma once
+
+#include "solve.hpp"
+#include "Sample.hpp"
+#include "io.hpp"
+
+#include <string>
+#include <vector>
+#include <memory>
+
+
+// Everything one run of the program needs to know.
+struct RunOptions {
+	std::string datasetDirectory;
+	std::string outNormalMap;
+	double correctionRadians = 0.0;
+
+	// If not empty, correctionRadians is ignored and one normal-map is
+	// written per correction in degrees, see sweepFile. The normals are
+	// solved once and only corrected per angle.
+	std::vector<int> sweepDegrees;
+
+	// Where to write the albedo-map, none if empty.
+	std::string outAlbedoMap;
+
+	// Where to write the heights integrated from the normals, none if empty.
+	std::string outHeightMap;
+
+	// If not empty, a coarse normal-map is written here right away and
+	// then replaced by finer ones while the dataset is read and solved.
+	std::string outPreviewMap;
+
+	// Bits and layout of the normal-map file.
+	OutputFormat output;
+
+	Precision precision = Precision::Double;
+	InstructionSet isa = detectInstructionSet();
+
+	// 16 bits keep the gray-values of 8-bit RGB-images almost exactly.
+	SampleFormat sampleFormat = SampleFormat::UInt16;
+
+	// Solves red, green and blue on their own instead of gray, for
+	// colored materials, and writes the albedo in color.
+	bool color = false;
+
+	// Adds each image to a sum as soon as it is decoded instead of
+	// keeping all of them, see Accumulator. Only for whole datasets in
+	// gray, without rejection.
+	bool incremental = false;
+
+	// Leaves shadows and highlights out of the solve.
+	Rejection rejection;
+
+	// If not 0, the dataset is streamed in bands of this many rows,
+	// so the memory needed depends on the band and not on the image.
+	std::size_t bandRows = 0;
+
+	// If not empty, the gray samples of the dataset are cached here,
+	// so the next run with the same images skips decoding, see cache.hpp.
+	std::string cacheDirectory;
+};
+
+
+// Reads the dataset, calculates the normal-map and writes it.
+void run(const RunOptions& options);
+
+
+// The normal-map of a sweep for the given degrees, "normals.png"
+// becomes "normals_15.png".
+std::string sweepFile(const std::string& outNormalMap, const int degrees);
+
+
+// One dataset of a batch.
+struct BatchJob {
+	std::string datasetDirectory;
+	std::string outNormalMap;
+	double correctionRadians = 0.0;
+	std::string outAlbedoMap;
+	std::string outHeightMap;
+};
+
+
+// A line of a batch, see readManifest.
+BatchJob parseJob(const std::string& line);
+
+
+// Reads a batch from a file with one line "dataset;result;correction"
+// per dataset, optionally followed by ";albedo" and ";height", the
+// correction in degrees. Fields left empty are not written. Empty lines and lines
+// starting with # are skipped.
+std::vector<BatchJob> readManifest(const std::string& file);
+
+
+// Runs all jobs with the same options, pipelined, and one thread-pool
+// for all of them. Returns the number of jobs that failed.
+std::size_t runBatch(const std::vector<BatchJob>& jobs, const RunOptions& options);
+
+
+// Throws if the options ask for more than whole datasets in gray, which
+// is all that batch mode and a Session do, e.g. "batch mode".
+void checkJobOptions(const RunOptions& options, const std::string& mode);
+
+
+// Seconds one job of a Session took.
+struct JobTimes {
+	// Reading and solving, they overlap.
+	double solve;
+
+	// The maps, with the heights integrated.
+	double write;
+
+	double total;
+};
+
+
+// Runs jobs one after another, like a batch but one at a time, and
+// keeps what the next job can use: the thread-pool, the solver as long
+// as the lights, the size and the correction stay the same, and the
+// memory of the samples and the normals. Only the precision, the
+// instruction set and the rejection of the options are used.
+template<typename Sample>
+class Session {
+public:
+	explicit Session(const RunOptions& options);
+
+	Session(const Session&) = delete;
+	Session& operator=(const Session&) = delete;
+
+	JobTimes run(const BatchJob& job, const OutputFormat& output);
+
+private:
+	const RunOptions options;
+	const unsigned int parallelism;
+	ThreadPool pool;
+
+	std::unique_ptr<const Solver<Sample>> solver;
+	std::vector<Vec3> solverDirections;
+	std::size_t solverWidth = 0;
+	std::size_t solverHeight = 0;
+	double solverCorrection = 0.0;
+
+	std::vector<Sample> samples;
+	std::vector<double> normalsData;
+	std::vector<double> albedoData;
+};
\ No newline at end of file
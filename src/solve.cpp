@@ -0,0 +1,483 @@
+#include "solve.hpp"
+#include "solveKernel.hpp"
+#include "Mat.hpp"
+#include "Vec.hpp"
+#include "util.hpp"
+#include "trace.hpp"
+using std::vector;
+using std::string;
+using std::size_t;
+using std::uint8_t;
+using std::uint16_t;
+using std::uint64_t;
+
+#include <iostream>
+using std::cout;
+
+#include <stdexcept>
+using std::invalid_argument;
+
+#include <memory>
+
+#include <algorithm>
+
+#include <bitset>
+
+#include <cmath>
+using std::cos;
+using std::sin;
+
+#include <cassert>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+
+// width and height of the image are scaled into [-1, 1].
+// that means the first pixel in x-axis / y-axis is always -1; 
+double distanceBetweenPixelPair(const size_t& length) {
+
+	// Pixel at Position 0
+	const double firstPixelPos = -1;
+
+	// Pixel at Position 1 
+	const double secondPixelPos = ((static_cast<double>(1) / (length - 1)) * 2 - 1);
+	const double distanceBetweenPixels = secondPixelPos - firstPixelPos;
+
+	return distanceBetweenPixels;
+}
+
+vector<double> correctionAnglesX(const size_t& height, const double scaledCorrectionFactor) {
+
+	vector<double> correctionAnglesX;
+	const double distanceBetweenPixelsX = distanceBetweenPixelPair(height);
+	double correctionIntensityX = -1;
+	for (size_t y = 0; y < height; y++) {
+		correctionAnglesX.push_back(scaledCorrectionFactor * correctionIntensityX);
+		correctionIntensityX += distanceBetweenPixelsX;
+	}
+
+	return correctionAnglesX;
+
+}
+
+vector<double> correctionAnglesY(const size_t& width, const double correctionFactor) {
+
+	vector<double> correctionAnglesY;
+
+	// we determine the distance between 2 pixels
+	// the distance information is used to determine the correction intensity for each pixel
+	const double distanceBetweenPixelsY = distanceBetweenPixelPair(width);
+
+	// -1 and 1 have the same correction intensity, whereas the mathematical sign influences the 'intensity's direction'
+	// intensity value of -1 and 1 have the strongest intensity and a value of 0 has no intensity
+	// -> the further the pixel is away from the center, the higher the correction intensity is 
+	double correctionIntensityY = -1;
+	for (size_t x = 0; x < width; x++) {
+		correctionAnglesY.push_back(correctionFactor * correctionIntensityY);
+		correctionIntensityY += distanceBetweenPixelsY;
+	}
+
+	return correctionAnglesY;
+
+}
+
+double calcSizeRatio(const size_t& height, const size_t& width) {
+	//check if height and width are even numbers
+	const size_t heightCalc = height % 2 != 0 ? height - 1 : height;
+	const size_t widthCalc = width % 2 != 0 ? width - 1 : width;
+
+	const double sizeRatio = static_cast<double>(heightCalc) / widthCalc;
+	return sizeRatio;
+}
+
+InstructionSet detectInstructionSet() {
+#if defined(_MSC_VER) && defined(_M_X64)
+	int info[4];
+	__cpuidex(info, 1, 0);
+	const bool osxsave = (info[2] & (1 << 27)) != 0;
+	const bool fma = (info[2] & (1 << 12)) != 0;
+	const bool f16c = (info[2] & (1 << 29)) != 0;
+
+	// The OS has to save the ymm/zmm registers too.
+	const unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+	const bool ymm = (xcr0 & 0x06) == 0x06;
+	const bool zmm = (xcr0 & 0xe6) == 0xe6;
+
+	__cpuidex(info, 7, 0);
+	const bool avx2 = (info[1] & (1 << 5)) != 0;
+	const bool avx512f = (info[1] & (1 << 16)) != 0;
+
+	if (avx512f && f16c && zmm) return InstructionSet::Avx512;
+	if (avx2 && fma && f16c && ymm) return InstructionSet::Avx2;
+#elif defined(__GNUC__) && defined(__x86_64__)
+	__builtin_cpu_init();
+	const bool f16c = __builtin_cpu_supports("f16c");
+	if (__builtin_cpu_supports("avx512f") && f16c) return InstructionSet::Avx512;
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") && f16c) return InstructionSet::Avx2;
+#endif
+	return InstructionSet::Scalar;
+}
+
+
+string toString(const InstructionSet isa) {
+	switch (isa) {
+	case InstructionSet::Avx512: return "avx512";
+	case InstructionSet::Avx2: return "avx2";
+	default: return "scalar";
+	}
+}
+
+
+InstructionSet parseInstructionSet(const string& s) {
+	if (s == "scalar") return InstructionSet::Scalar;
+	if (s == "avx2") return InstructionSet::Avx2;
+	if (s == "avx512") return InstructionSet::Avx512;
+	throw invalid_argument{ "Unknown instruction set: " + s };
+}
+
+
+Precision parsePrecision(const string& s) {
+	if (s == "double") return Precision::Double;
+	if (s == "float") return Precision::Float;
+	throw invalid_argument{ "Unknown precision: " + s };
+}
+
+
+// L^T * L for the lights in the subset (bit k for light k). L has
+// one light-direction per row, so that is the sum of the outer
+// products of their directions.
+Mat3 transposedTimesL(const vector<Vec3>& lightDirs, const uint64_t subset) {
+	Mat3 result{};
+	for (size_t k = 0; k < lightDirs.size(); ++k) {
+		if (!(subset >> k & 1)) continue;
+
+		const Vec3& l = lightDirs[k];
+		for (int i = 0; i < 3; ++i) {
+			for (int j = 0; j < 3; ++j) {
+				result.at(i, j) += l[i] * l[j];
+			}
+		}
+	}
+	return result;
+}
+
+
+double determinant(const Mat3& A) {
+	return
+		A.at(0, 0) * (A.at(1, 1) * A.at(2, 2) - A.at(1, 2) * A.at(2, 1)) -
+		A.at(0, 1) * (A.at(1, 0) * A.at(2, 2) - A.at(1, 2) * A.at(2, 0)) +
+		A.at(0, 2) * (A.at(1, 0) * A.at(2, 1) - A.at(1, 1) * A.at(2, 0));
+}
+
+
+// L^T * L is only invertible if the lights don't lie in a plane.
+// Its eigenvalues are in [0, nLights], so a tiny determinant
+// means that they (almost) do.
+const double MIN_DETERMINANT = 1e-9;
+
+
+bool invertible(const Mat3& L_transposedL) {
+	return determinant(L_transposedL) >= MIN_DETERMINANT;
+}
+
+
+// The columns of L_inverseTransposed = (L^T * L)^-1 * L^T for the
+// lights in the subset, zero for all others. Scaling them is the
+// same as scaling the samples.
+template<typename Real, typename Sample>
+vector<Real> pseudoInverse(const vector<Vec3>& lightDirs, const uint64_t subset, const Mat3& L_transposedL) {
+	const Mat3 L_inverse = L_transposedL.inverse();
+
+	vector<Real> columns;
+	columns.reserve(lightDirs.size() * 3);
+
+	for (size_t k = 0; k < lightDirs.size(); ++k) {
+		const Vec3 column = subset >> k & 1
+			? (L_inverse * lightDirs[k]) * SampleTraits<Sample>::scale
+			: Vec3{};
+		for (int i = 0; i < 3; ++i) {
+			columns.push_back(static_cast<Real>(column[i]));
+		}
+	}
+	return columns;
+}
+
+
+Correction::Correction(const size_t width, const size_t height, const double correctionFactor)
+	:
+	width(width)
+{
+	const vector<double> anglesY = correctionAnglesY(width, correctionFactor);
+	const vector<double> anglesX = correctionAnglesX(height, correctionFactor * calcSizeRatio(height, width));
+
+	for (const double angle : anglesY) {
+		cosY.push_back(cos(angle));
+		sinY.push_back(sin(angle));
+	}
+	for (const double angle : anglesX) {
+		cosX.push_back(cos(angle));
+		sinX.push_back(sin(angle));
+	}
+}
+
+
+void combineChannels(
+	const double* const normals[3],
+	const double* const albedo[3],
+	const size_t nPixels,
+	double* out,
+	double* rgbAlbedo)
+{
+	for (size_t i = 0; i < nPixels; ++i) {
+		double sum[3] = { 0.0, 0.0, 0.0 };
+		for (size_t c = 0; c < 3; ++c) {
+			// A black channel has no direction.
+			if (albedo[c][i] > 0.0) {
+				for (size_t j = 0; j < 3; ++j) {
+					sum[j] += albedo[c][i] * normals[c][i * 3 + j];
+				}
+			}
+			if (rgbAlbedo) {
+				rgbAlbedo[i * 3 + c] = albedo[c][i];
+			}
+		}
+
+		const double length = sqrt(sum[0] * sum[0] + sum[1] * sum[1] + sum[2] * sum[2]);
+		for (size_t j = 0; j < 3; ++j) {
+			// Black in all channels, like gray would be.
+			out[i * 3 + j] = length > 0.0 ? sum[j] / length : normals[1][i * 3 + j];
+		}
+	}
+}
+
+
+template<typename Real, typename Sample>
+SolveTables<Real> makeSolveTables(
+	const vector<Vec3>& lightDirs,
+	const size_t width,
+	const size_t height,
+	const double correctionFactor,
+	const Rejection& rejection)
+{
+	SolveTables<Real> tables;
+	tables.stride = LightStack<Sample>::strideFor(width);
+
+	const size_t nLights = lightDirs.size();
+	const uint64_t allLights = nLights == 64 ? ~uint64_t(0) : (uint64_t(1) << nLights) - 1;
+
+	const Mat3 L_transposedL = transposedTimesL(lightDirs, allLights);
+	if (!invertible(L_transposedL)) {
+		throw invalid_argument{ "The light-directions must not lie in one plane." };
+	}
+	tables.L_inverseTransposed = pseudoInverse<Real, Sample>(lightDirs, allLights, L_transposedL);
+
+	tables.rejection = rejection.enabled;
+	if (rejection.enabled) {
+		if (nLights > Rejection::MAX_LIGHTS) {
+			throw invalid_argument{ "Rejection works with at most " + std::to_string(Rejection::MAX_LIGHTS) + " lights." };
+		}
+
+		// In the units of the samples, like the pseudo-inverse.
+		tables.shadowBound = static_cast<Real>(rejection.shadowThreshold / SampleTraits<Sample>::scale);
+		tables.specularBound = static_cast<Real>(rejection.specularThreshold / SampleTraits<Sample>::scale);
+
+		// With less than 3 lights, or lights in a plane, there is no
+		// solution, so these subsets simply use all lights.
+		tables.subsetInverses.reserve((allLights + 1) * nLights * 3);
+		for (uint64_t subset = 0; subset <= allLights; ++subset) {
+			const Mat3 A = transposedTimesL(lightDirs, subset);
+			const vector<Real> inverse = std::bitset<64>(subset).count() >= 3 && determinant(A) >= MIN_DETERMINANT
+				? pseudoInverse<Real, Sample>(lightDirs, subset, A)
+				: tables.L_inverseTransposed;
+			tables.subsetInverses.insert(tables.subsetInverses.end(), inverse.begin(), inverse.end());
+		}
+	}
+
+	const Correction correction{ width, height, correctionFactor };
+
+	// The padding gets the last column, so loads there stay harmless.
+	tables.cosY.resize(tables.stride);
+	tables.sinY.resize(tables.stride);
+	for (size_t x = 0; x < tables.stride; ++x) {
+		const size_t column = x < width ? x : width - 1;
+		tables.cosY[x] = static_cast<Real>(correction.cosY[column]);
+		tables.sinY[x] = static_cast<Real>(correction.sinY[column]);
+	}
+
+	tables.cosX.assign(correction.cosX.begin(), correction.cosX.end());
+	tables.sinX.assign(correction.sinX.begin(), correction.sinX.end());
+
+	return tables;
+}
+
+
+template<typename Real, typename Sample>
+RowKernel<Real, Sample> selectRowKernel(const InstructionSet isa, const size_t nLights) {
+	switch (isa) {
+#if defined(__x86_64__) || defined(_M_X64)
+	case InstructionSet::Avx512: return rowKernelAvx512<Real, Sample>(nLights);
+	case InstructionSet::Avx2: return rowKernelAvx2<Real, Sample>(nLights);
+#endif
+	default: return rowKernelFor<ScalarPack<Real>, Sample>(nLights);
+	}
+}
+
+
+template<typename Real>
+CorrectKernel<Real> selectCorrectKernel(const InstructionSet isa) {
+	switch (isa) {
+#if defined(__x86_64__) || defined(_M_X64)
+	case InstructionSet::Avx512: return correctKernelAvx512<Real>();
+	case InstructionSet::Avx2: return correctKernelAvx2<Real>();
+#endif
+	default: return correctRow<ScalarPack<Real>>;
+	}
+}
+
+
+// The tile solver and the row corrector share the tables.
+template<typename Real, typename Sample>
+void makeKernels(
+	const vector<Vec3>& lightDirections,
+	const size_t width,
+	const size_t height,
+	const double correctionFactor,
+	const InstructionSet isa,
+	const Rejection& rejection,
+	const bool normalize,
+	typename Solver<Sample>::TileSolver& tileSolver,
+	typename Solver<Sample>::RowCorrector& rowCorrector)
+{
+	SolveTables<Real> solveTables = makeSolveTables<Real, Sample>(lightDirections, width, height, correctionFactor, rejection);
+	solveTables.normalize = normalize;
+	const auto tables = std::make_shared<const SolveTables<Real>>(std::move(solveTables));
+
+	const RowKernel<Real, Sample> kernel = selectRowKernel<Real, Sample>(isa, lightDirections.size());
+	tileSolver = [tables, kernel](const LightStack<Sample>& band, const Tile& tile, double* out, double* albedo) {
+		for (size_t y = tile.yBegin; y < tile.yEnd; ++y) {
+			kernel(band, *tables, y, tile.xBegin, tile.xEnd,
+				out + y * band.width * 3, albedo ? albedo + y * band.width : nullptr);
+		}
+	};
+
+	const CorrectKernel<Real> correct = selectCorrectKernel<Real>(isa);
+	rowCorrector = [tables, correct, width](const double* in, double* out, const size_t firstRow, const size_t nRows, double* albedo) {
+		for (size_t y = 0; y < nRows; ++y) {
+			correct(in + y * width * 3, *tables, firstRow + y, 0, width,
+				out + y * width * 3, albedo ? albedo + y * width : nullptr);
+		}
+	};
+}
+
+
+template<typename Sample>
+Solver<Sample>::Solver(
+	const vector<Vec3>& lightDirections,
+	const size_t width,
+	const size_t height,
+	const double correctionFactor,
+	const Precision precision,
+	const InstructionSet requested,
+	const Rejection& rejection,
+	const bool normalize)
+	:
+	precision(precision),
+	// Never use more than the CPU can do.
+	isa(std::min(requested, detectInstructionSet()))
+{
+	if (precision == Precision::Float) {
+		makeKernels<float, Sample>(lightDirections, width, height, correctionFactor, isa, rejection, normalize, tileSolver, rowCorrector);
+	}
+	else {
+		makeKernels<double, Sample>(lightDirections, width, height, correctionFactor, isa, rejection, normalize, tileSolver, rowCorrector);
+	}
+}
+
+
+template<typename Sample>
+void Solver<Sample>::work(const LightStack<Sample>& band, TileScheduler& scheduler, double* out, double* albedo) const {
+	scheduler.work([this, &band, out, albedo](const Tile& tile) {
+		const TraceSpan span{ "solve" };
+		solveTile(band, tile, out, albedo);
+	});
+}
+
+
+template<typename Sample>
+void Solver<Sample>::solve(
+	const LightStack<Sample>& band,
+	double* out,
+	ThreadPool& pool,
+	const unsigned int nWorkers,
+	double* albedo) const
+{
+	TileScheduler scheduler{ band.width, band.height };
+	scheduler.run(pool, nWorkers, [this, &band, out, albedo](const Tile& tile) {
+		const TraceSpan span{ "solve" };
+		solveTile(band, tile, out, albedo);
+	});
+}
+
+
+template class Solver<uint8_t>;
+template class Solver<uint16_t>;
+template class Solver<Half>;
+template class Solver<float>;
+
+
+template<typename Sample>
+NormalMap photometricStereo(
+	const LightStack<Sample>& dataset,
+	const double correctionFactor,
+	const Precision precision,
+	const InstructionSet isa)
+{
+	const Solver<Sample> solver{
+		dataset.lightDirections, dataset.width, dataset.height, correctionFactor, precision, isa };
+
+	cout << "Kernel: " << toString(solver.isa) << (precision == Precision::Float ? ", float\n" : ", double\n");
+
+	const unsigned int parallelism = std::thread::hardware_concurrency();
+	assert(parallelism > 0);
+	ThreadPool pool{ parallelism };
+
+	cout << "Calculating ... (" << parallelism << " threads)\n";
+
+	vector<double> normalsData(dataset.width * dataset.height * 3);
+	// The calling thread is one of the workers.
+	solver.solve(dataset, &normalsData[0], pool, parallelism - 1);
+
+	return NormalMap{ dataset.width, dataset.height, std::move(normalsData) };
+}
+
+
+template<typename Sample>
+NormalMap photometricStereo(
+	const LightStack<Sample>& dataset,
+	const double correctionFactor,
+	ThreadPool& pool,
+	const unsigned int nWorkers,
+	const Precision precision,
+	const InstructionSet isa,
+	const Rejection& rejection)
+{
+	const Solver<Sample> solver{
+		dataset.lightDirections, dataset.width, dataset.height, correctionFactor, precision, isa, rejection };
+
+	vector<double> normalsData(dataset.width * dataset.height * 3);
+	solver.solve(dataset, &normalsData[0], pool, nWorkers);
+
+	return NormalMap{ dataset.width, dataset.height, std::move(normalsData) };
+}
+
+
+template NormalMap photometricStereo(const LightStack<uint8_t>&, const double, const Precision, const InstructionSet);
+template NormalMap photometricStereo(const LightStack<uint16_t>&, const double, const Precision, const InstructionSet);
+template NormalMap photometricStereo(const LightStack<Half>&, const double, const Precision, const InstructionSet);
+template NormalMap photometricStereo(const LightStack<float>&, const double, const Precision, const InstructionSet);
+template NormalMap photometricStereo(const LightStack<uint8_t>&, const double, ThreadPool&, const unsigned int, const Precision, const InstructionSet, const Rejection&);
+template NormalMap photometricStereo(const LightStack<uint16_t>&, const double, ThreadPool&, const unsigned int, const Precision, const InstructionSet, const Rejection&);
+template NormalMap photometricStereo(const LightStack<Half>&, const double, ThreadPool&, const unsigned int, const Precision, const InstructionSet, const Rejection&);
+template NormalMap photometricStereo(const LightStack<float>&, const double, ThreadPool&, const unsigned int, const Precision, const InstructionSet, const Rejection&);
\ No newline at end of file
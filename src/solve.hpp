@@ -0,0 +1,216 @@
+#pragma once
+
+#include "LightStack.hpp"
+#include "NormalMap.hpp"
+#include "Vec.hpp"
+#include "Mat.hpp"
+#include "TileScheduler.hpp"
+
+#include "../submodules/ThreadPool/ThreadPool.h"
+
+#include <vector>
+#include <string>
+#include <functional>
+
+
+// Precision the per-pixel math is done in. The intensities
+// come from 8-bit images, so float is plenty for most data.
+enum class Precision { Double, Float };
+
+// Instruction sets the solver has a kernel for.
+enum class InstructionSet { Scalar, Avx2, Avx512 };
+
+
+// The best instruction set this CPU (and OS) supports.
+InstructionSet detectInstructionSet();
+
+std::string toString(const InstructionSet isa);
+InstructionSet parseInstructionSet(const std::string& s);
+Precision parsePrecision(const std::string& s);
+
+
+// Samples outside [shadowThreshold, specularThreshold] are taken as
+// shadow or highlight and left out of the solve of their pixel, as
+// long as at least 3 lights are left. The thresholds are in [0, 1],
+// see SampleTraits.
+struct Rejection {
+	// The pseudo-inverse of every subset of the lights is precomputed,
+	// so there are 2^nLights of them.
+	static constexpr std::size_t MAX_LIGHTS = 12;
+
+	bool enabled = false;
+	double shadowThreshold = 0.0;
+	double specularThreshold = 1.0;
+};
+
+
+// False if the lights of L^T * L (nearly) lie in one plane, then
+// there is no solution.
+bool invertible(const Mat3& L_transposedL);
+
+
+// The orientation correction of pixel (x, y) is
+// Mat3::rotationX(angle of row y) * Mat3::rotationY(angle of column x),
+// stored as cos and sin of the angles. A rotation keeps the length, so
+// normals solved with correction factor 0 can be corrected afterwards,
+// for as many factors as needed, without solving them again, see
+// Solver::correct.
+struct Correction {
+	std::size_t width;
+
+	// One per column and one per row.
+	std::vector<double> cosY;
+	std::vector<double> sinY;
+	std::vector<double> cosX;
+	std::vector<double> sinX;
+
+	Correction(const std::size_t width, const std::size_t height, const double correctionFactor);
+};
+
+
+// Colored photometric stereo solves red, green and blue on their own.
+// The normal of a pixel is the direction of the sum of the unnormalized
+// normals of the channels, i.e. of their normals weighted by the albedo.
+// The albedo of the channels is interleaved into rgbAlbedo, unless it is
+// null.
+void combineChannels(
+	const double* const normals[3],
+	const double* const albedo[3],
+	const std::size_t nPixels,
+	double* out,
+	double* rgbAlbedo = nullptr);
+
+
+// Everything per dataset the kernels need, precomputed once
+// and converted to the precision the kernel works in.
+template<typename Real>
+struct SolveTables {
+	// Length of cosY and sinY, equal to LightStack::stride.
+	std::size_t stride;
+
+	// The columns of L_inverseTransposed, (x, y, z) for each light.
+	std::vector<Real> L_inverseTransposed;
+
+	// The Correction, with cosY and sinY padded to the stride. The
+	// kernel multiplies the two rotations out by hand, which leaves
+	// very few operations.
+	std::vector<Real> cosY;
+	std::vector<Real> sinY;
+	std::vector<Real> cosX;
+	std::vector<Real> sinX;
+
+	// If false, the corrected normals are written unnormalized, i.e.
+	// times the albedo.
+	bool normalize = true;
+
+	// Only with Rejection: the bounds in the units of the samples and
+	// the columns like L_inverseTransposed for every subset of the
+	// lights, the subset with bit k set for light k at
+	// [subset * nLights * 3]. The columns of lights not in the subset
+	// are zero.
+	bool rejection = false;
+	Real shadowBound = 0;
+	Real specularBound = 0;
+	std::vector<Real> subsetInverses;
+};
+
+
+// The pseudo-inverse is scaled by SampleTraits<Sample>::scale,
+// which maps the samples into [0, 1] on the fly.
+template<typename Real, typename Sample>
+SolveTables<Real> makeSolveTables(
+	const std::vector<Vec3>& lightDirections,
+	const std::size_t width,
+	const std::size_t height,
+	const double correctionFactor,
+	const Rejection& rejection = {});
+
+
+// Solves bands of a dataset with the kernel for the given precision
+// and instruction set. If the CPU doesn't support the instruction
+// set, then the next best one is used. The tables are built once
+// for the whole image, so any band of it can be solved.
+template<typename Sample>
+class Solver {
+public:
+	// Solves a tile of a band, the pointers to the normals and
+	// the albedo (or null) of the band.
+	using TileSolver = std::function<void(const LightStack<Sample>&, const Tile&, double*, double*)>;
+
+	// Corrects rows of the image, see correct.
+	using RowCorrector = std::function<void(const double*, double*, std::size_t, std::size_t, double*)>;
+
+	const Precision precision;
+	const InstructionSet isa;
+
+	Solver(
+		const std::vector<Vec3>& lightDirections,
+		const std::size_t width,
+		const std::size_t height,
+		const double correctionFactor,
+		const Precision precision,
+		const InstructionSet requested,
+		const Rejection& rejection = {},
+		const bool normalize = true);
+
+
+	// Writes the normals of the tile as (x, y, z) one after another
+	// into out, which holds the normals of the whole band. The albedo
+	// is written likewise, one value per pixel, unless it is null.
+	void solveTile(const LightStack<Sample>& band, const Tile& tile, double* out, double* albedo = nullptr) const {
+		tileSolver(band, tile, out, albedo);
+	}
+
+
+	// Solves the tiles the scheduler hands out until none are left.
+	// The scheduler has to be made for the size of the band.
+	void work(const LightStack<Sample>& band, TileScheduler& scheduler, double* out, double* albedo = nullptr) const;
+
+
+	// Solves the band in parallel on nWorkers tasks of the pool
+	// and the calling thread, see solveTile.
+	void solve(
+		const LightStack<Sample>& band,
+		double* out,
+		ThreadPool& pool,
+		const unsigned int nWorkers,
+		double* albedo = nullptr) const;
+
+
+	// Corrects the unnormalized normals of nRows rows, the first one is
+	// row firstRow of the image, from in to out and writes the albedo
+	// unless it is null, like solveTile. The normals have to come from a
+	// solver with the same precision and instruction set, without
+	// correction and normalize false. Then they are bit for bit those
+	// this solver would have written, for any number of corrections
+	// from one solve.
+	void correct(const double* in, double* out, const std::size_t firstRow, const std::size_t nRows, double* albedo = nullptr) const {
+		rowCorrector(in, out, firstRow, nRows, albedo);
+	}
+
+private:
+	TileSolver tileSolver;
+	RowCorrector rowCorrector;
+};
+
+
+// Calculates the normal of every pixel in the dataset, see Solver.
+template<typename Sample>
+NormalMap photometricStereo(
+	const LightStack<Sample>& dataset,
+	const double correctionFactor,
+	const Precision precision = Precision::Double,
+	const InstructionSet isa = detectInstructionSet());
+
+
+// Like above, but quietly on nWorkers tasks of the
+// pool and the calling thread, so it can run often.
+template<typename Sample>
+NormalMap photometricStereo(
+	const LightStack<Sample>& dataset,
+	const double correctionFactor,
+	ThreadPool& pool,
+	const unsigned int nWorkers,
+	const Precision precision = Precision::Double,
+	const InstructionSet isa = detectInstructionSet(),
+	const Rejection& rejection = {});
\ No newline at end of file
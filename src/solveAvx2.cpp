@@ -0,0 +1,138 @@
+// The row-kernel compiled for AVX2, FMA and F16C. It is only
+// called if detectInstructionSet() found them on the CPU.
+
+#include "solve.hpp"
+#include "LightStack.hpp"
+#include "Sample.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <type_traits>
+
+#if defined(__x86_64__) || defined(_M_X64)
+
+#include <immintrin.h>
+
+#if defined(__clang__)
+#pragma clang attribute push (__attribute__((target("avx2,fma,f16c"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx2,fma,f16c")
+#endif
+
+#include "solveKernel.hpp"
+
+
+// 4 doubles
+struct Avx2Double {
+	using Real = double;
+	static constexpr std::size_t WIDTH = 4;
+
+	__m256d v;
+
+	static Avx2Double zero() { return { _mm256_setzero_pd() }; }
+	static Avx2Double broadcast(const double x) { return { _mm256_set1_pd(x) }; }
+	static Avx2Double loadReal(const double* p) { return { _mm256_loadu_pd(p) }; }
+	void store(double* p) const { _mm256_storeu_pd(p, v); }
+
+	static Avx2Double load(const std::uint8_t* p) {
+		int bytes;
+		std::memcpy(&bytes, p, sizeof bytes);
+		return { _mm256_cvtepi32_pd(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(bytes))) };
+	}
+	static Avx2Double load(const std::uint16_t* p) {
+		const __m128i words = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p));
+		return { _mm256_cvtepi32_pd(_mm_cvtepu16_epi32(words)) };
+	}
+	static Avx2Double load(const Half* p) {
+		const __m128i halfs = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p));
+		return { _mm256_cvtps_pd(_mm_cvtph_ps(halfs)) };
+	}
+	static Avx2Double load(const float* p) { return { _mm256_cvtps_pd(_mm_loadu_ps(p)) }; }
+
+	Avx2Double operator+(const Avx2Double b) const { return { _mm256_add_pd(v, b.v) }; }
+	Avx2Double operator*(const Avx2Double b) const { return { _mm256_mul_pd(v, b.v) }; }
+	Avx2Double operator/(const Avx2Double b) const { return { _mm256_div_pd(v, b.v) }; }
+	static Avx2Double fmadd(const Avx2Double a, const Avx2Double b, const Avx2Double c) { return { _mm256_fmadd_pd(a.v, b.v, c.v) }; }
+	static Avx2Double fmsub(const Avx2Double a, const Avx2Double b, const Avx2Double c) { return { _mm256_fmsub_pd(a.v, b.v, c.v) }; }
+	static Avx2Double sqrt(const Avx2Double a) { return { _mm256_sqrt_pd(a.v) }; }
+	unsigned int outside(const Avx2Double lower, const Avx2Double upper) const {
+		return _mm256_movemask_pd(_mm256_or_pd(_mm256_cmp_pd(v, lower.v, _CMP_LT_OQ), _mm256_cmp_pd(v, upper.v, _CMP_GT_OQ)));
+	}
+};
+
+
+// 8 floats
+struct Avx2Float {
+	using Real = float;
+	static constexpr std::size_t WIDTH = 8;
+
+	__m256 v;
+
+	static Avx2Float zero() { return { _mm256_setzero_ps() }; }
+	static Avx2Float broadcast(const float x) { return { _mm256_set1_ps(x) }; }
+	static Avx2Float loadReal(const float* p) { return { _mm256_loadu_ps(p) }; }
+	void store(float* p) const { _mm256_storeu_ps(p, v); }
+
+	static Avx2Float load(const std::uint8_t* p) {
+		const __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p));
+		return { _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(bytes)) };
+	}
+	static Avx2Float load(const std::uint16_t* p) {
+		const __m128i words = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+		return { _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(words)) };
+	}
+	static Avx2Float load(const Half* p) {
+		return { _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))) };
+	}
+	static Avx2Float load(const float* p) { return { _mm256_loadu_ps(p) }; }
+
+	Avx2Float operator+(const Avx2Float b) const { return { _mm256_add_ps(v, b.v) }; }
+	Avx2Float operator*(const Avx2Float b) const { return { _mm256_mul_ps(v, b.v) }; }
+	Avx2Float operator/(const Avx2Float b) const { return { _mm256_div_ps(v, b.v) }; }
+	static Avx2Float fmadd(const Avx2Float a, const Avx2Float b, const Avx2Float c) { return { _mm256_fmadd_ps(a.v, b.v, c.v) }; }
+	static Avx2Float fmsub(const Avx2Float a, const Avx2Float b, const Avx2Float c) { return { _mm256_fmsub_ps(a.v, b.v, c.v) }; }
+	static Avx2Float sqrt(const Avx2Float a) { return { _mm256_sqrt_ps(a.v) }; }
+	unsigned int outside(const Avx2Float lower, const Avx2Float upper) const {
+		return _mm256_movemask_ps(_mm256_or_ps(_mm256_cmp_ps(v, lower.v, _CMP_LT_OQ), _mm256_cmp_ps(v, upper.v, _CMP_GT_OQ)));
+	}
+};
+
+
+template<typename Real, typename Sample>
+RowKernel<Real, Sample> rowKernelAvx2(const std::size_t nLights) {
+	using Pack = std::conditional_t<std::is_same<Real, float>::value, Avx2Float, Avx2Double>;
+	return rowKernelFor<Pack, Sample>(nLights);
+}
+
+
+template RowKernel<double, std::uint8_t> rowKernelAvx2(const std::size_t);
+template RowKernel<double, std::uint16_t> rowKernelAvx2(const std::size_t);
+template RowKernel<double, Half> rowKernelAvx2(const std::size_t);
+template RowKernel<double, float> rowKernelAvx2(const std::size_t);
+template RowKernel<float, std::uint8_t> rowKernelAvx2(const std::size_t);
+template RowKernel<float, std::uint16_t> rowKernelAvx2(const std::size_t);
+template RowKernel<float, Half> rowKernelAvx2(const std::size_t);
+template RowKernel<float, float> rowKernelAvx2(const std::size_t);
+
+
+template<typename Real>
+CorrectKernel<Real> correctKernelAvx2() {
+	using Pack = std::conditional_t<std::is_same<Real, float>::value, Avx2Float, Avx2Double>;
+	return correctRow<Pack>;
+}
+
+
+template CorrectKernel<double> correctKernelAvx2();
+template CorrectKernel<float> correctKernelAvx2();
+
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+
+#endif
\ No newline at end of file
@@ -0,0 +1,136 @@
+// The row-kernel compiled for AVX-512F (and F16C, which every CPU
+// with AVX-512 has). It is only called if detectInstructionSet()
+// found AVX-512F on the CPU.
+
+#include "solve.hpp"
+#include "LightStack.hpp"
+#include "Sample.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <cmath>
+#include <type_traits>
+
+#if defined(__x86_64__) || defined(_M_X64)
+
+#include <immintrin.h>
+
+#if defined(__clang__)
+#pragma clang attribute push (__attribute__((target("avx512f,f16c"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx512f,f16c")
+#endif
+
+#include "solveKernel.hpp"
+
+
+// 8 doubles
+struct Avx512Double {
+	using Real = double;
+	static constexpr std::size_t WIDTH = 8;
+
+	__m512d v;
+
+	static Avx512Double zero() { return { _mm512_setzero_pd() }; }
+	static Avx512Double broadcast(const double x) { return { _mm512_set1_pd(x) }; }
+	static Avx512Double loadReal(const double* p) { return { _mm512_loadu_pd(p) }; }
+	void store(double* p) const { _mm512_storeu_pd(p, v); }
+
+	static Avx512Double load(const std::uint8_t* p) {
+		const __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p));
+		return { _mm512_cvtepi32_pd(_mm256_cvtepu8_epi32(bytes)) };
+	}
+	static Avx512Double load(const std::uint16_t* p) {
+		const __m128i words = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+		return { _mm512_cvtepi32_pd(_mm256_cvtepu16_epi32(words)) };
+	}
+	static Avx512Double load(const Half* p) {
+		return { _mm512_cvtps_pd(_mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)))) };
+	}
+	static Avx512Double load(const float* p) { return { _mm512_cvtps_pd(_mm256_loadu_ps(p)) }; }
+
+	Avx512Double operator+(const Avx512Double b) const { return { _mm512_add_pd(v, b.v) }; }
+	Avx512Double operator*(const Avx512Double b) const { return { _mm512_mul_pd(v, b.v) }; }
+	Avx512Double operator/(const Avx512Double b) const { return { _mm512_div_pd(v, b.v) }; }
+	static Avx512Double fmadd(const Avx512Double a, const Avx512Double b, const Avx512Double c) { return { _mm512_fmadd_pd(a.v, b.v, c.v) }; }
+	static Avx512Double fmsub(const Avx512Double a, const Avx512Double b, const Avx512Double c) { return { _mm512_fmsub_pd(a.v, b.v, c.v) }; }
+	static Avx512Double sqrt(const Avx512Double a) { return { _mm512_sqrt_pd(a.v) }; }
+	unsigned int outside(const Avx512Double lower, const Avx512Double upper) const {
+		return _mm512_cmp_pd_mask(v, lower.v, _CMP_LT_OQ) | _mm512_cmp_pd_mask(v, upper.v, _CMP_GT_OQ);
+	}
+};
+
+
+// 16 floats
+struct Avx512Float {
+	using Real = float;
+	static constexpr std::size_t WIDTH = 16;
+
+	__m512 v;
+
+	static Avx512Float zero() { return { _mm512_setzero_ps() }; }
+	static Avx512Float broadcast(const float x) { return { _mm512_set1_ps(x) }; }
+	static Avx512Float loadReal(const float* p) { return { _mm512_loadu_ps(p) }; }
+	void store(float* p) const { _mm512_storeu_ps(p, v); }
+
+	static Avx512Float load(const std::uint8_t* p) {
+		const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+		return { _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(bytes)) };
+	}
+	static Avx512Float load(const std::uint16_t* p) {
+		const __m256i words = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+		return { _mm512_cvtepi32_ps(_mm512_cvtepu16_epi32(words)) };
+	}
+	static Avx512Float load(const Half* p) {
+		return { _mm512_cvtph_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p))) };
+	}
+	static Avx512Float load(const float* p) { return { _mm512_loadu_ps(p) }; }
+
+	Avx512Float operator+(const Avx512Float b) const { return { _mm512_add_ps(v, b.v) }; }
+	Avx512Float operator*(const Avx512Float b) const { return { _mm512_mul_ps(v, b.v) }; }
+	Avx512Float operator/(const Avx512Float b) const { return { _mm512_div_ps(v, b.v) }; }
+	static Avx512Float fmadd(const Avx512Float a, const Avx512Float b, const Avx512Float c) { return { _mm512_fmadd_ps(a.v, b.v, c.v) }; }
+	static Avx512Float fmsub(const Avx512Float a, const Avx512Float b, const Avx512Float c) { return { _mm512_fmsub_ps(a.v, b.v, c.v) }; }
+	static Avx512Float sqrt(const Avx512Float a) { return { _mm512_sqrt_ps(a.v) }; }
+	unsigned int outside(const Avx512Float lower, const Avx512Float upper) const {
+		return _mm512_cmp_ps_mask(v, lower.v, _CMP_LT_OQ) | _mm512_cmp_ps_mask(v, upper.v, _CMP_GT_OQ);
+	}
+};
+
+
+template<typename Real, typename Sample>
+RowKernel<Real, Sample> rowKernelAvx512(const std::size_t nLights) {
+	using Pack = std::conditional_t<std::is_same<Real, float>::value, Avx512Float, Avx512Double>;
+	return rowKernelFor<Pack, Sample>(nLights);
+}
+
+
+template RowKernel<double, std::uint8_t> rowKernelAvx512(const std::size_t);
+template RowKernel<double, std::uint16_t> rowKernelAvx512(const std::size_t);
+template RowKernel<double, Half> rowKernelAvx512(const std::size_t);
+template RowKernel<double, float> rowKernelAvx512(const std::size_t);
+template RowKernel<float, std::uint8_t> rowKernelAvx512(const std::size_t);
+template RowKernel<float, std::uint16_t> rowKernelAvx512(const std::size_t);
+template RowKernel<float, Half> rowKernelAvx512(const std::size_t);
+template RowKernel<float, float> rowKernelAvx512(const std::size_t);
+
+
+template<typename Real>
+CorrectKernel<Real> correctKernelAvx512() {
+	using Pack = std::conditional_t<std::is_same<Real, float>::value, Avx512Float, Avx512Double>;
+	return correctRow<Pack>;
+}
+
+
+template CorrectKernel<double> correctKernelAvx512();
+template CorrectKernel<float> correctKernelAvx512();
+
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+
+#endif
\ No newline at end of file
@@ -0,0 +1,302 @@
+#pragma once
+
+// The row-kernel of the solver, written once against a "pack" of
+// WIDTH values and instantiated for every instruction set. Every
+// function in here has to be a template on the pack, because the
+// SIMD translation-units include this file with their target
+// options switched on. For the same reason the operations of a
+// pack are members: GCC ignores the target options for friends
+// defined inside a class.
+
+#include "solve.hpp"
+#include "LightStack.hpp"
+#include "Sample.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <cmath>
+#include <cassert>
+
+
+// A pack of a single value, used for the scalar fallback.
+template<typename T>
+struct ScalarPack {
+	using Real = T;
+	static constexpr std::size_t WIDTH = 1;
+
+	T v;
+
+	static ScalarPack zero() { return { T(0) }; }
+	static ScalarPack broadcast(const T x) { return { x }; }
+	static ScalarPack load(const std::uint8_t* p) { return { static_cast<T>(*p) }; }
+	static ScalarPack load(const std::uint16_t* p) { return { static_cast<T>(*p) }; }
+	static ScalarPack load(const Half* p) { return { static_cast<T>(toFloat(*p)) }; }
+	static ScalarPack load(const float* p) { return { static_cast<T>(*p) }; }
+	static ScalarPack loadReal(const T* p) { return { *p }; }
+	void store(T* p) const { *p = v; }
+
+	ScalarPack operator+(const ScalarPack b) const { return { v + b.v }; }
+	ScalarPack operator*(const ScalarPack b) const { return { v * b.v }; }
+	ScalarPack operator/(const ScalarPack b) const { return { v / b.v }; }
+	static ScalarPack fmadd(const ScalarPack a, const ScalarPack b, const ScalarPack c) { return { a.v * b.v + c.v }; }
+	static ScalarPack fmsub(const ScalarPack a, const ScalarPack b, const ScalarPack c) { return { a.v * b.v - c.v }; }
+	static ScalarPack sqrt(const ScalarPack a) { return { std::sqrt(a.v) }; }
+
+	// Bit i is set if value i is below lower or above upper.
+	unsigned int outside(const ScalarPack lower, const ScalarPack upper) const { return v < lower.v || upper.v < v; }
+};
+
+
+// Corrects the unnormalized normals of the pixels [x, x + WIDTH) of a
+// row, see SolveTables::normalize, and writes those up to xEnd into out
+// and albedo like solveRow, which this is the end of.
+template<typename Pack>
+void correctPack(
+	const Pack nx,
+	const Pack ny,
+	const Pack nz,
+	const SolveTables<typename Pack::Real>& tables,
+	const Pack cosX,
+	const Pack sinX,
+	const std::size_t x,
+	const std::size_t xEnd,
+	double* out,
+	double* albedo)
+{
+	using Real = typename Pack::Real;
+	constexpr std::size_t WIDTH = Pack::WIDTH;
+
+	// orientation correction, rotationX(row) * rotationY(column) * n
+	// multiplied out:
+	//   [ cY,        0,    sY       ]
+	//   [ sX * sY,   cX,   -sX * cY ]
+	//   [ -cX * sY,  sX,   cX * cY  ]
+	// with t = sY * nx - cY * nz shared by the last two rows.
+	const Pack cosY = Pack::loadReal(&tables.cosY[x]);
+	const Pack sinY = Pack::loadReal(&tables.sinY[x]);
+	const Pack t = Pack::fmsub(sinY, nx, cosY * nz);
+
+	const Pack bx = Pack::fmadd(cosY, nx, sinY * nz);
+	const Pack by = Pack::fmadd(sinX, t, cosX * ny);
+	const Pack bz = Pack::fmsub(sinX, ny, cosX * t);
+
+	const Pack length = Pack::sqrt(Pack::fmadd(bx, bx, Pack::fmadd(by, by, bz * bz)));
+
+	Real normalX[WIDTH];
+	Real normalY[WIDTH];
+	Real normalZ[WIDTH];
+	if (tables.normalize) {
+		(bx / length).store(normalX);
+		(by / length).store(normalY);
+		(bz / length).store(normalZ);
+	}
+	else {
+		bx.store(normalX);
+		by.store(normalY);
+		bz.store(normalZ);
+	}
+
+	// The last pack of a range can reach beyond it.
+	const std::size_t n = xEnd - x < WIDTH ? xEnd - x : WIDTH;
+	double* dst = out + x * 3;
+
+	for (std::size_t i = 0; i < n; ++i) {
+		dst[i * 3] = normalX[i];
+		dst[i * 3 + 1] = normalY[i];
+		dst[i * 3 + 2] = normalZ[i];
+	}
+
+	if (albedo) {
+		Real lengths[WIDTH];
+		length.store(lengths);
+		for (std::size_t i = 0; i < n; ++i) {
+			albedo[x + i] = lengths[i];
+		}
+	}
+}
+
+
+// Solves the columns [xBegin, xEnd) of row y of the dataset (which
+// can be a band of the image) and writes the normals as (x, y, z)
+// one after another into out, which points to the start of the row.
+// If albedo isn't null, the length of each unnormalized normal, i.e.
+// the albedo of the pixel, is written into it the same way.
+// xBegin has to be a multiple of BLOCK_WIDTH. If N_LIGHTS isn't 0,
+// the dataset has exactly that many lights and the loop over them
+// gets unrolled.
+template<typename Pack, std::size_t N_LIGHTS, typename Sample>
+void solveRow(
+	const LightStack<Sample>& dataset,
+	const SolveTables<typename Pack::Real>& tables,
+	const std::size_t y,
+	const std::size_t xBegin,
+	const std::size_t xEnd,
+	double* out,
+	double* albedo)
+{
+	using Real = typename Pack::Real;
+	constexpr std::size_t BLOCK_WIDTH = LightStack<Sample>::BLOCK_WIDTH;
+	constexpr std::size_t WIDTH = Pack::WIDTH;
+	static_assert(BLOCK_WIDTH % WIDTH == 0, "A pack must not cross blocks.");
+
+	assert(N_LIGHTS == 0 || N_LIGHTS == dataset.nLights);
+	const std::size_t nLights = N_LIGHTS != 0 ? N_LIGHTS : dataset.nLights;
+	const Real* P = &tables.L_inverseTransposed[0];
+
+	const Pack shadowBound = Pack::broadcast(tables.shadowBound);
+	const Pack specularBound = Pack::broadcast(tables.specularBound);
+
+	const Pack cosX = Pack::broadcast(tables.cosX[dataset.firstRow + y]);
+	const Pack sinX = Pack::broadcast(tables.sinX[dataset.firstRow + y]);
+
+	for (std::size_t x = xBegin; x < xEnd; x += WIDTH) {
+		const Sample* samples = dataset.block(x, y) + x % BLOCK_WIDTH;
+
+		// This is what you saw in the paper by Woodham (1980).
+		// L_inverseTransposed * I for WIDTH pixels at once.
+		Pack nx = Pack::zero();
+		Pack ny = Pack::zero();
+		Pack nz = Pack::zero();
+
+		unsigned int rejected = 0;
+
+		for (std::size_t k = 0; k < nLights; ++k) {
+			const Pack I = Pack::load(samples + k * BLOCK_WIDTH);
+			nx = Pack::fmadd(Pack::broadcast(P[k * 3]), I, nx);
+			ny = Pack::fmadd(Pack::broadcast(P[k * 3 + 1]), I, ny);
+			nz = Pack::fmadd(Pack::broadcast(P[k * 3 + 2]), I, nz);
+
+			if (tables.rejection) {
+				rejected |= I.outside(shadowBound, specularBound);
+			}
+		}
+
+		// Pixels with shadows or highlights are solved again, one
+		// by one, with the pseudo-inverse of their remaining lights.
+		if (rejected != 0) {
+			Real sumX[WIDTH];
+			Real sumY[WIDTH];
+			Real sumZ[WIDTH];
+			nx.store(sumX);
+			ny.store(sumY);
+			nz.store(sumZ);
+
+			for (std::size_t i = 0; i < WIDTH; ++i) {
+				if (!(rejected >> i & 1)) continue;
+
+				Real I[N_LIGHTS != 0 ? N_LIGHTS : Rejection::MAX_LIGHTS];
+				std::uint64_t subset = 0;
+				for (std::size_t k = 0; k < nLights; ++k) {
+					I[k] = ScalarPack<Real>::load(samples + k * BLOCK_WIDTH + i).v;
+					const bool valid = tables.shadowBound <= I[k] && I[k] <= tables.specularBound;
+					subset |= std::uint64_t(valid) << k;
+				}
+
+				const Real* Q = &tables.subsetInverses[subset * nLights * 3];
+				Real x = 0;
+				Real y = 0;
+				Real z = 0;
+				for (std::size_t k = 0; k < nLights; ++k) {
+					x += Q[k * 3] * I[k];
+					y += Q[k * 3 + 1] * I[k];
+					z += Q[k * 3 + 2] * I[k];
+				}
+				sumX[i] = x;
+				sumY[i] = y;
+				sumZ[i] = z;
+			}
+
+			nx = Pack::loadReal(sumX);
+			ny = Pack::loadReal(sumY);
+			nz = Pack::loadReal(sumZ);
+		}
+
+		correctPack(nx, ny, nz, tables, cosX, sinX, x, xEnd, out, albedo);
+	}
+}
+
+
+template<typename Real, typename Sample>
+using RowKernel = void (*)(const LightStack<Sample>&, const SolveTables<Real>&, std::size_t, std::size_t, std::size_t, double*, double*);
+
+
+// The kernel for the pack, specialized for the common numbers
+// of lights and generic for all others.
+template<typename Pack, typename Sample>
+RowKernel<typename Pack::Real, Sample> rowKernelFor(const std::size_t nLights) {
+	switch (nLights) {
+	case 4: return solveRow<Pack, 4, Sample>;
+	case 6: return solveRow<Pack, 6, Sample>;
+	case 8: return solveRow<Pack, 8, Sample>;
+	case 12: return solveRow<Pack, 12, Sample>;
+	case 16: return solveRow<Pack, 16, Sample>;
+	case 24: return solveRow<Pack, 24, Sample>;
+	default: return solveRow<Pack, 0, Sample>;
+	}
+}
+
+
+// Corrects the columns [xBegin, xEnd) of row y of the image, whose
+// unnormalized normals (x, y, z) in, which points to the start of the
+// row, holds, and writes them into out and albedo like solveRow. The
+// normals have to come from tables in the same precision without
+// correction, then they are bit for bit those solveRow writes with
+// these tables. xBegin has to be a multiple of Pack::WIDTH.
+template<typename Pack>
+void correctRow(
+	const double* in,
+	const SolveTables<typename Pack::Real>& tables,
+	const std::size_t y,
+	const std::size_t xBegin,
+	const std::size_t xEnd,
+	double* out,
+	double* albedo)
+{
+	using Real = typename Pack::Real;
+	constexpr std::size_t WIDTH = Pack::WIDTH;
+	assert(xBegin % WIDTH == 0);
+
+	const Pack cosX = Pack::broadcast(tables.cosX[y]);
+	const Pack sinX = Pack::broadcast(tables.sinX[y]);
+
+	for (std::size_t x = xBegin; x < xEnd; x += WIDTH) {
+		const std::size_t n = xEnd - x < WIDTH ? xEnd - x : WIDTH;
+		const double* src = in + x * 3;
+
+		// The values were Real before, so nothing gets lost.
+		Real nx[WIDTH] = {};
+		Real ny[WIDTH] = {};
+		Real nz[WIDTH] = {};
+		for (std::size_t i = 0; i < n; ++i) {
+			nx[i] = static_cast<Real>(src[i * 3]);
+			ny[i] = static_cast<Real>(src[i * 3 + 1]);
+			nz[i] = static_cast<Real>(src[i * 3 + 2]);
+		}
+
+		correctPack(Pack::loadReal(nx), Pack::loadReal(ny), Pack::loadReal(nz), tables, cosX, sinX, x, xEnd, out, albedo);
+	}
+}
+
+
+template<typename Real>
+using CorrectKernel = void (*)(const double*, const SolveTables<Real>&, std::size_t, std::size_t, std::size_t, double*, double*);
+
+
+#if defined(__x86_64__) || defined(_M_X64)
+
+// Defined in solveAvx2.cpp and solveAvx512.cpp for all
+// combinations of double/float and the sample types.
+template<typename Real, typename Sample>
+RowKernel<Real, Sample> rowKernelAvx2(const std::size_t nLights);
+
+template<typename Real, typename Sample>
+RowKernel<Real, Sample> rowKernelAvx512(const std::size_t nLights);
+
+// Likewise for double and float.
+template<typename Real>
+CorrectKernel<Real> correctKernelAvx2();
+
+template<typename Real>
+CorrectKernel<Real> correctKernelAvx512();
+
+#endif
\ No newline at end of file
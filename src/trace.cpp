@@ -0,0 +1,310 @@
+#include "trace.hpp"
+using std::string;
+using std::size_t;
+using std::uint64_t;
+using std::int64_t;
+
+#include <chrono>
+using std::chrono::steady_clock;
+using std::chrono::duration_cast;
+using std::chrono::microseconds;
+
+#include <vector>
+using std::vector;
+
+#include <atomic>
+using std::atomic;
+
+#include <mutex>
+using std::mutex;
+using std::lock_guard;
+
+#include <memory>
+using std::unique_ptr;
+using std::make_unique;
+
+#include <map>
+using std::map;
+
+#include <fstream>
+using std::ofstream;
+
+#include <stdexcept>
+using std::invalid_argument;
+
+#include <algorithm>
+using std::min;
+using std::max;
+
+#include <filesystem>
+
+#include <cassert>
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+
+struct TraceEvent {
+	const char* stage;
+	int64_t begin;
+	int64_t duration;
+
+	// Number of spans of the thread this one is within.
+	unsigned int depth;
+};
+
+
+// Only ever touched by its thread, until the trace is written.
+struct ThreadTrace {
+	unsigned int id;
+	string name;
+	vector<TraceEvent> events;
+	unsigned int depth = 0;
+
+	// Set when the thread ended, under threadsMutex.
+	bool ended = false;
+};
+
+
+atomic<bool> enabled{ false };
+steady_clock::time_point origin;
+
+// Outlive their threads, as pool threads end before the trace is written.
+mutex threadsMutex;
+vector<unique_ptr<ThreadTrace>> threads;
+map<string, uint64_t> counters;
+unsigned int nextThreadId = 0;
+
+
+// The trace of the calling thread, marked as ended with the thread,
+// so restartTracing can drop it.
+struct LocalTrace {
+	ThreadTrace* trace = nullptr;
+
+	~LocalTrace() {
+		if (trace) {
+			const lock_guard<mutex> lock{ threadsMutex };
+			trace->ended = true;
+		}
+	}
+};
+
+thread_local LocalTrace localTrace;
+
+
+ThreadTrace& threadTrace() {
+	if (!localTrace.trace) {
+		const lock_guard<mutex> lock{ threadsMutex };
+		threads.push_back(make_unique<ThreadTrace>());
+		ThreadTrace& trace = *threads.back();
+		trace.id = nextThreadId++;
+		trace.name = trace.id == 0 ? "main" : "thread " + std::to_string(trace.id);
+		localTrace.trace = &trace;
+	}
+	return *localTrace.trace;
+}
+
+
+int64_t sinceOrigin(const steady_clock::time_point t) {
+	return duration_cast<microseconds>(t - origin).count();
+}
+
+
+void enableTracing() {
+	origin = steady_clock::now();
+	threadTrace();
+	enabled = true;
+}
+
+
+bool tracingEnabled() {
+	return enabled.load(std::memory_order_relaxed);
+}
+
+
+void restartTracing() {
+	const lock_guard<mutex> lock{ threadsMutex };
+	threads.erase(std::remove_if(threads.begin(), threads.end(), [](const unique_ptr<ThreadTrace>& thread) { return thread->ended; }), threads.end());
+	for (const unique_ptr<ThreadTrace>& thread : threads) {
+		assert(thread->depth == 0);
+		thread->events.clear();
+	}
+	counters.clear();
+	origin = steady_clock::now();
+}
+
+
+TraceSpan::TraceSpan(const char* stage)
+	:
+	stage(tracingEnabled() ? stage : nullptr)
+{
+	if (this->stage) {
+		++threadTrace().depth;
+		begin = steady_clock::now();
+	}
+}
+
+
+TraceSpan::~TraceSpan() {
+	if (stage) {
+		const steady_clock::time_point end = steady_clock::now();
+		ThreadTrace& trace = threadTrace();
+		--trace.depth;
+		trace.events.push_back({ stage, sinceOrigin(begin), duration_cast<microseconds>(end - begin).count(), trace.depth });
+	}
+}
+
+
+void traceThreadName(const string& name) {
+	if (tracingEnabled()) {
+		threadTrace().name = name;
+	}
+}
+
+
+void traceCount(const char* counter, const uint64_t amount) {
+	if (tracingEnabled()) {
+		const lock_guard<mutex> lock{ threadsMutex };
+		counters[counter] += amount;
+	}
+}
+
+
+void traceFileBytes(const char* counter, const string& file) {
+	if (tracingEnabled()) {
+		std::error_code error;
+		const uint64_t size = std::filesystem::file_size(file, error);
+		if (!error) {
+			traceCount(counter, size);
+		}
+	}
+}
+
+
+uint64_t peakResidentBytes() {
+#if defined(_WIN32)
+	PROCESS_MEMORY_COUNTERS memory;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &memory, sizeof memory)) return 0;
+	return memory.PeakWorkingSetSize;
+#else
+	rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#if defined(__APPLE__)
+	return static_cast<uint64_t>(usage.ru_maxrss);
+#else
+	// In kilobytes.
+	return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+
+// Stage and thread names are ours, only quotes and backslashes could hurt.
+string quoted(const string& s) {
+	string q = "\"";
+	for (const char c : s) {
+		if (c == '"' || c == '\\') q += '\\';
+		q += c;
+	}
+	return q + '"';
+}
+
+
+ofstream openTraceFile(const string& file) {
+	ofstream out{ file };
+	if (!out) throw invalid_argument{ "Cannot create file: " + file };
+	return out;
+}
+
+
+void writeChromeTrace(const string& file) {
+	ofstream out = openTraceFile(file);
+	const int64_t end = sinceOrigin(steady_clock::now());
+
+	out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"MaterialScannerHsH\"}}";
+
+	for (const unique_ptr<ThreadTrace>& thread : threads) {
+		out << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread->id
+			<< ",\"args\":{\"name\":" << quoted(thread->name) << "}}";
+
+		for (const TraceEvent& event : thread->events) {
+			out << ",\n{\"name\":" << quoted(event.stage) << ",\"cat\":\"stage\",\"ph\":\"X\",\"pid\":1,\"tid\":" << thread->id
+				<< ",\"ts\":" << event.begin << ",\"dur\":" << event.duration << '}';
+		}
+	}
+
+	for (const auto& [counter, amount] : counters) {
+		out << ",\n{\"name\":" << quoted(counter) << ",\"ph\":\"C\",\"pid\":1,\"ts\":" << end
+			<< ",\"args\":{\"value\":" << amount << "}}";
+	}
+	out << ",\n{\"name\":\"peak resident bytes\",\"ph\":\"C\",\"pid\":1,\"ts\":" << end
+		<< ",\"args\":{\"value\":" << peakResidentBytes() << "}}";
+
+	out << "\n]}\n";
+	if (!out) throw invalid_argument{ "Cannot write file: " + file };
+}
+
+
+void writeTraceSummary(const string& file) {
+	ofstream out = openTraceFile(file);
+	const int64_t wall = sinceOrigin(steady_clock::now());
+
+	struct StageTotal {
+		int64_t time = 0;
+		size_t count = 0;
+	};
+	map<string, StageTotal> stages;
+	for (const unique_ptr<ThreadTrace>& thread : threads) {
+		for (const TraceEvent& event : thread->events) {
+			StageTotal& total = stages[event.stage];
+			total.time += event.duration;
+			++total.count;
+		}
+	}
+
+	const auto seconds = [](const int64_t us) { return us / 1000000.0; };
+
+	out << "{\n\"wallSeconds\": " << seconds(wall) << ",\n\"stages\": {";
+	const char* separator = "\n";
+	for (const auto& [stage, total] : stages) {
+		out << separator << "\t" << quoted(stage) << ": {\"seconds\": " << seconds(total.time) << ", \"count\": " << total.count << '}';
+		separator = ",\n";
+	}
+
+	out << "\n},\n\"threads\": [";
+	separator = "\n";
+	for (const unique_ptr<ThreadTrace>& thread : threads) {
+		// Spans within others are already part of them.
+		int64_t busy = 0;
+		int64_t first = wall;
+		for (const TraceEvent& event : thread->events) {
+			if (event.depth == 0) busy += event.duration;
+			first = min(first, event.begin);
+		}
+
+		out << separator << "\t{\"name\": " << quoted(thread->name) << ", \"busySeconds\": " << seconds(busy)
+			<< ", \"idleSeconds\": " << seconds(max<int64_t>(0, wall - first - busy)) << '}';
+		separator = ",\n";
+	}
+
+	out << "\n],\n\"counters\": {";
+	separator = "\n";
+	for (const auto& [counter, amount] : counters) {
+		out << separator << "\t" << quoted(counter) << ": " << amount;
+		separator = ",\n";
+	}
+
+	out << "\n},\n\"peakResidentBytes\": " << peakResidentBytes() << "\n}\n";
+	if (!out) throw invalid_argument{ "Cannot write file: " + file };
+}
\ No newline at end of file
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <chrono>
+
+
+// Instrumentation of a run: spans of time per thread, named after the
+// stage they measure ("decode", "solve", "encode", ...), and counters
+// like the bytes read. Nothing is recorded until tracing is enabled,
+// then a span costs two reads of the clock. What was recorded is
+// written after the run, when no thread records anymore.
+
+
+void enableTracing();
+bool tracingEnabled();
+
+// Drops all spans and counters, and the threads that ended, and starts
+// the clock anew, for a process that runs for long, like the daemon,
+// which traces each job on its own. Only when no thread records, like
+// writing.
+void restartTracing();
+
+
+// Measures the scope it lives in as a span of the stage. A span
+// within another one of the same thread counts only for its stage,
+// not again for the thread being busy.
+class TraceSpan {
+public:
+	// The name has to live until the trace is written, like a literal.
+	explicit TraceSpan(const char* stage);
+	~TraceSpan();
+
+	TraceSpan(const TraceSpan&) = delete;
+	TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+	const char* stage;
+	std::chrono::steady_clock::time_point begin;
+};
+
+
+// Names the calling thread in the trace, the one enabling it is "main".
+void traceThreadName(const std::string& name);
+
+void traceCount(const char* counter, const std::uint64_t amount);
+
+// Counts the size of the file, e.g. as "bytes read" or "bytes written".
+void traceFileBytes(const char* counter, const std::string& file);
+
+
+// The most memory the process had resident so far, 0 if unknown.
+std::uint64_t peakResidentBytes();
+
+
+// All spans as Chrome trace JSON, for chrome://tracing or Perfetto,
+// one track per thread and the counters at the end.
+void writeChromeTrace(const std::string& file);
+
+// JSON with the wall time, the time and count per stage, the busy and
+// idle time per thread, the counters and the peak resident memory. A
+// thread is idle from its first span on, threads started later are
+// not idle before they were there.
+void writeTraceSummary(const std::string& file);
\ No newline at end of file
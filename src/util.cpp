@@ -12,6 +12,20 @@ using std::abs;
 #include <sstream>
 using std::stringstream;
 
+#include <stdexcept>
+using std::invalid_argument;
+
+#include <exception>
+using std::exception_ptr;
+using std::current_exception;
+using std::rethrow_exception;
+
+#include <algorithm>
+using std::sort;
+using std::adjacent_find;
+
+using std::future;
+
 
 // This program most likely won't ever process images
 // with a bit-depth > 16, so this is our limit.
@@ -28,16 +42,6 @@ double degreesToRadians(const double deg) {
 }
 
 
-bool allSmallerEqualTo(const vector<double>& data, const double lim) {
-	for (const double d : data) {
-		if (!(d <= lim)) {
-			return false;
-		}
-	}
-	return true;
-}
-
-
 vector<string> splitBy(const string& s, const char d) {
 	stringstream ss{ s };
 	string word;
@@ -46,4 +50,60 @@ vector<string> splitBy(const string& s, const char d) {
 		words.push_back(word);
 	}
 	return words;
+}
+
+
+vector<int> parseDegrees(const string& s) {
+	vector<int> degrees;
+	const vector<string> range = splitBy(s, ':');
+
+	if (range.size() == 3) {
+		const int first = std::stoi(range[0]);
+		const int last = std::stoi(range[1]);
+		const int step = std::stoi(range[2]);
+		if (step <= 0 || last < first) throw invalid_argument{ "Range expected as \"first:last:step\": " + s };
+
+		for (int deg = first; deg <= last; deg += step) {
+			degrees.push_back(deg);
+		}
+	}
+	else if (range.size() == 1) {
+		for (const string& deg : splitBy(s, ',')) {
+			degrees.push_back(std::stoi(deg));
+		}
+	}
+
+	if (degrees.empty()) throw invalid_argument{ "Degrees expected: " + s };
+
+	// Each angle has its own output file.
+	vector<int> sorted = degrees;
+	sort(sorted.begin(), sorted.end());
+	const auto duplicate = adjacent_find(sorted.begin(), sorted.end());
+	if (duplicate != sorted.end()) throw invalid_argument{ "Degrees given twice: " + std::to_string(*duplicate) };
+	return degrees;
+}
+
+
+void waitAll(vector<future<void>>& futures) {
+	exception_ptr error;
+	for (future<void>& f : futures) {
+		try {
+			f.get();
+		}
+		catch (...) {
+			if (!error) {
+				error = current_exception();
+			}
+		}
+	}
+	if (error) {
+		rethrow_exception(error);
+	}
+}
+
+
+void waitFor(vector<future<void>>& futures) {
+	for (future<void>& f : futures) {
+		if (f.valid()) f.wait();
+	}
 }
\ No newline at end of file
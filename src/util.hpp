@@ -2,9 +2,22 @@
 
 #include <vector>
 #include <string>
+#include <future>
 
 
 bool nearlyEqual(const double a, const double b);
 double degreesToRadians(const double deg);
-bool allSmallerEqualTo(const std::vector<double>& data, const double lim);
-std::vector<std::string> splitBy(const std::string& s, const char d);
\ No newline at end of file
+std::vector<std::string> splitBy(const std::string& s, const char d);
+
+// Parses whole degrees as "15", a list "0,5,10" or a range
+// "first:last:step", which includes last if the step gets there.
+// Throws if a list has an angle twice.
+std::vector<int> parseDegrees(const std::string& s);
+
+// Waits for all futures, even if some of them failed,
+// and then rethrows the first failure.
+void waitAll(std::vector<std::future<void>>& futures);
+
+// Waits for the futures that weren't waited for yet and ignores how
+// they ended, for when there already is an error to throw.
+void waitFor(std::vector<std::future<void>>& futures);
\ No newline at end of file